@@ -6,23 +6,109 @@
 #define _GNU_SOURCE
 
 #include <ctype.h> // gives us: iscntrl()
+#include <dirent.h> // gives us: opendir(), readdir(), closedir(), dirfd(), DIR, struct dirent
 #include <errno.h> // gives us: EAGAIN and errno
-#include <fcntl.h> // gives us: open(), O_CREAT, O_RDWR
+#include <fcntl.h> // gives us: open(), O_CREAT, O_RDWR, O_WRONLY
+#include <limits.h> // gives us: INT_MAX, ULLONG_MAX
+#include <poll.h> // gives us: poll(), struct pollfd, POLLIN
+#include <pthread.h> // gives us: pthread_create(), pthread_join(), pthread_mutex_lock(), pthread_mutex_unlock(), pthread_cond_wait(), pthread_cond_signal(), pthread_t, pthread_mutex_t, pthread_cond_t
+#include <regex.h> // gives us: regcomp(), regexec(), regfree(), regex_t, regmatch_t, REG_EXTENDED, REG_NOTBOL, REG_STARTEND
+#include <sched.h> // gives us: sched_yield()
+#include <signal.h> // gives us: sigaction(), struct sigaction, sigemptyset(), sig_atomic_t, SIGWINCH, SA_RESTART
 #include <stdarg.h> // gives us va_end(), va_start(), va_list
-#include <stdio.h> // gives us: FILE, fopen(), getline(), perror(), printf(), snprintf(), sscanf(), vsnprintf()
-#include <stdlib.h> // gives us: atexit(), exit(), free(), malloc(), realloc()
-#include <string.h> // gives us: memcpy(), memmove(), memset(), strchr(), strcmp(), strdup(), strerror(), strlen(), strncmp(), strrchr(), strstr()
+#include <stddef.h> // gives us: offsetof()
+#include <stdint.h> // gives us: uint64_t, uint32_t, int64_t
+#include <stdio.h> // gives us: FILE, fclose(), fopen(), fprintf(), getline(), perror(), printf(), rename(), snprintf(), vsnprintf()
+#include <stdlib.h> // gives us: atexit(), atoi(), exit(), free(), getenv(), malloc(), mkdtemp(), mkstemp(), qsort(), realloc(), realpath()
+#include <string.h> // gives us: memchr(), memcmp(), memcpy(), memmove(), memset(), strchr(), strcmp(), strdup(), strerror(), strlen(), strncmp(), strndup(), strrchr(), strstr()
 #include <sys/ioctl.h> // gives us: icoctl(), TIOCGWINSZ, struct winsize
-#include <sys/types.h> // gives us: ssize_t
+#include <sys/mman.h> // gives us: mmap(), munmap(), PROT_READ, MAP_PRIVATE, MAP_FAILED
+#include <sys/stat.h> // gives us: fchmod(), fstat(), fstatat(), stat(), struct stat, S_ISREG()
+#include <sys/types.h> // gives us: ssize_t, off_t
+#include <sys/uio.h> // gives us: writev(), struct iovec
 #include <termios.h>  // gives us: struct termios, tcgetattr(), tcsetattr(), ECHO, ICANON, ICRNL, IXTEN, ISIG, IXON, TCSAFLUSH, and also BRKINT, INPCK, ISTRIP, and CS8. also VMIN and VTIME
-#include <time.h> // gives us: time(), time_t
-#include <unistd.h> // gives us: standard symbolic constants and types, also close(), ftruncate(), write() and STDOUT_FILENO
+#include <time.h> // gives us: time(), time_t, clock_gettime(), struct timespec, CLOCK_MONOTONIC
+#include <unistd.h> // gives us: standard symbolic constants and types, also close(), copy_file_range(), dup(), dup2(), fchown(), fsync(), ftruncate(), lseek(), pipe(), pread(), rmdir(), unlink(), unlinkat(), write(), sysconf() and STDOUT_FILENO
+
+// follow mode finds out that a file has grown from the kernel, with inotify on Linux and kqueue on the BSDs and macOS. anywhere else it just checks the file every KILO_FOLLOW_MS
+#if defined(__linux__)
+#include <sys/inotify.h> // gives us: inotify_init1(), inotify_add_watch(), inotify_rm_watch(), IN_MODIFY, IN_ATTRIB, IN_MOVE_SELF, IN_DELETE_SELF, IN_NONBLOCK, IN_CLOEXEC
+#define KILO_FOLLOW_INOTIFY
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || defined(__DragonFly__)
+#include <sys/event.h> // gives us: kqueue(), kevent(), struct kevent, EV_SET(), EVFILT_VNODE, EV_ADD, EV_CLEAR, NOTE_WRITE, NOTE_EXTEND, NOTE_ATTRIB, NOTE_RENAME, NOTE_DELETE
+#define KILO_FOLLOW_KQUEUE
+#endif
+
+// the session cache checks a file's modification time to the nanosecond, which macOS keeps under a different name
+#if defined(__APPLE__)
+#define st_mtim st_mtimespec
+#endif
+
+// the line indexer looks for newlines, and editorUpdateRow() checks whether a row is all ASCII, a whole vector register at a time when the compiler tells us the CPU has a vector instruction set it knows
+#if defined(__AVX2__)
+#include <immintrin.h> // gives us: _mm256_loadu_si256(), _mm256_cmpeq_epi8(), _mm256_set1_epi8(), _mm256_movemask_epi8(), _mm256_or_si256()
+#define KILO_SCAN_WIDTH 32
+#elif defined(__SSE2__)
+#include <emmintrin.h> // gives us: _mm_loadu_si128(), _mm_cmpeq_epi8(), _mm_set1_epi8(), _mm_movemask_epi8(), _mm_or_si128()
+#define KILO_SCAN_WIDTH 16
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h> // gives us: vld1q_u8(), vceqq_u8(), vdupq_n_u8(), vmaxvq_u8(), vorrq_u8()
+#define KILO_SCAN_WIDTH 16
+#endif
 
 /*** defines ***/
 
 #define KILO_VERSION "0.0.1"
 #define KILO_TAB_STOP 8
 #define KILO_QUIT_TIMES 2
+#define KILO_GAP_MIN 16 // the smallest gap we'll open up in a row when it runs out of room
+#define KILO_LONG_ROW (1 << 16) // rows longer than this many bytes only have the part of them that's on the screen rendered and highlighted
+#define KILO_ROW_MARK 4096 // how many bytes apart the checkpoints along a long row are
+#define KILO_BLOCK_ROWS 512 // the most rows a single block of the row store holds before we split it in two
+#define KILO_INDEX_CHUNK (1 << 22) // how many bytes of a memory-mapped file we index before drawing the first screen. the rest of the file gets indexed by background threads
+#define KILO_INDEX_THREADS 8 // the most threads we'll use to index a file
+#define KILO_HL_BATCH 1024 // how many rows the background highlighter goes through each time it takes the editor lock
+#define KILO_SAVE_IOV 1024 // how many pieces of text a save hands to each writev() call
+#define KILO_SAVE_CHUNK (1 << 20) // the size of the buffers a save copies changed text into
+// how many seconds go by between autosaves of a file with unsaved changes. 0 turns autosave off, which is the default, but it can be turned on by building with -DKILO_AUTOSAVE=30, for example
+#ifndef KILO_AUTOSAVE
+#define KILO_AUTOSAVE 0
+#endif
+#define KILO_SEARCH_BATCH 65536 // how many rows the search goes through at a time, split between its threads, before it checks whether it has found what it's looking for or a key has been pressed
+#define KILO_SEARCH_THREADS 8 // the most threads we'll use to search
+#define KILO_FRAME_MS 16 // the shortest time between two redraws, in milliseconds, which is about one frame of a 60Hz display. changes that come in faster than that get drawn together
+#define KILO_GUESS_ROWS 24 // the size we take the terminal to be when ioctl() can't tell us, until the terminal answers our question about where the cursor is
+#define KILO_GUESS_COLS 80
+#define KILO_CACHE_MAGIC "kilocch2" // the first 8 bytes of a session cache file, which change whenever its layout does
+#define KILO_CACHE_FILES 64 // the most session cache files we keep in the KILO_CACHE directory. when there are more, the ones that were used the longest time ago get removed
+#define KILO_ESC_MS 100 // how long we wait for the rest of an escape sequence, in milliseconds, before deciding the user just pressed Escape
+#define KILO_ARENA_CHUNK (1 << 20) // the size of the chunks an arena hands out its memory from
+#define KILO_POOL_MIN 16 // the smallest and largest size classes of the row pools. anything bigger than KILO_POOL_MAX comes straight from malloc()
+#define KILO_POOL_MAX 4096
+#define KILO_POOL_CLASSES 9 // one size class for each power of two from KILO_POOL_MIN to KILO_POOL_MAX
+#define KILO_UNDO_BYTES (1 << 26) // the size of the ring the undo log is kept in. once it's full, the oldest edits fall off the end of it and can't be undone any more
+#define KILO_UNDO_RUN 4096 // the most text a run of typing or deleting adds up to in one record of the undo log before the run carries on in a new record
+#define KILO_FOLLOW_CHUNK (1 << 24) // the most bytes follow mode reads from a file that has grown before it lets the event loop handle keys and draw the screen again
+#define KILO_FOLLOW_MS 1000 // how often, in milliseconds, a file being followed gets checked even when the kernel hasn't told us it changed, which covers a log that's rotated and then created again under the same name
+// the size of the screen the benchmarks draw, and of the files they make up, when the editor is built with -DKILO_BENCH. each can be changed with a -D of its own, to run the benchmarks on something smaller, for example
+#ifndef KILO_BENCH_ROWS
+#define KILO_BENCH_ROWS 40
+#endif
+#ifndef KILO_BENCH_COLS
+#define KILO_BENCH_COLS 120
+#endif
+#ifndef KILO_BENCH_LOG_LINES
+#define KILO_BENCH_LOG_LINES 1000000 // the lines of the log file
+#endif
+#ifndef KILO_BENCH_LINE_BYTES
+#define KILO_BENCH_LINE_BYTES (50 << 20) // the bytes of the file that's all one line
+#endif
+#ifndef KILO_BENCH_NEST_LINES
+#define KILO_BENCH_NEST_LINES 200000 // the lines of the file of nested blocks and comments
+#endif
+#define KILO_STATS_WINDOW 256 // how many of the latest frames the percentiles on the instrumentation line are worked out from
+#define KILO_CELL_COMPLEX (1ULL << 63) // marks a screen cell whose character is wide or has combining marks on it. the cell to the right of a wide character holds just this bit. the other 7 bytes of a cell hold its UTF-8 bytes
+#define KILO_ATTR_INVERSE 0x80 // the bit of a screen cell's attribute that says it's drawn with inverted colors. the rest of the attribute is the editorHighlight value whose color the cell is drawn with
 
 // the CTRL_KEY macro bitwise-ANDS a character with the value 00011111, essentially setting the upper 3 bits to 0, mirroring what the Ctrl key does in the terminal
 // // the ASCII character set seems designed this way on purpose. Similarly it is designed so that you can set and clear bit 5 to switch between lowercase and uppercase
@@ -41,7 +127,8 @@ enum editorKey {
     HOME_KEY,
     END_KEY,
     PAGE_UP,
-    PAGE_DOWN
+    PAGE_DOWN,
+    PASTE_KEY // a bracketed paste, whose text is in E.paste
 };
 
 // here we'll have each value in the hl array corespond to a character in render, and it will tell us whether that character is part of a string, comment, number, etc. and this enum will contain the possible values hl can contain
@@ -53,12 +140,41 @@ enum editorHighlight {
     HL_KEYWORD2,
     HL_STRING,
     HL_NUMBER,
-    HL_MATCH
+    HL_MATCH,
+    HL_COUNT // the number of highlight types, not a highlight type itself
 };
 
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
 #define HL_HIGHLIGHT_STRINGS (1<<1)
 
+#define ROW_MAPPED (1<<0) // the row's chars point straight into the memory-mapped file, so they must be copied before the row can be edited
+#define ROW_HL_STALE (1<<1) // the state the row starts in has changed since its hl was filled in, so it must be highlighted again before it's drawn
+#define ROW_ARENA (1<<2) // the row's chars are in E.rowarena, where a file read in line by line keeps its text. like a mapped row's, they must be copied before the row can be edited
+#define ROW_UTF8 (1<<3) // the row has bytes in it that aren't ASCII, so a byte of its render isn't always a column of the screen, and it has to be decoded to be drawn
+#define ROW_WINDOWED (1<<4) // the row is longer than KILO_LONG_ROW, so its render and hl only hold a window of it around the columns on the screen
+
+/*** allocation counting ***/
+
+// with instrumentation on, we count the allocations the editor makes, so we can tell how many each frame needs. the editor allocates through kmalloc(), kcalloc() and krealloc(), which add one to the count and then call the C library's own functions. the background threads allocate too, so the count is added to atomically
+// // allocations made for us inside the C library, like the ones strdup() and getline() make, don't get counted
+int alloc_counting;
+unsigned long alloc_count;
+
+void *kmalloc(size_t size) {
+    if (alloc_counting) __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    return malloc(size);
+}
+
+void *kcalloc(size_t n, size_t size) {
+    if (alloc_counting) __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    return calloc(n, size);
+}
+
+void *krealloc(void *ptr, size_t size) {
+    if (alloc_counting) __atomic_add_fetch(&alloc_count, 1, __ATOMIC_RELAXED);
+    return realloc(ptr, size);
+}
+
 /*** data ***/
 
 struct editorSyntax {
@@ -71,33 +187,366 @@ struct editorSyntax {
     int flags; // this will be a bit field that will contain flags for whether to highlight numbers and whether to highlight strings for that filetype
 };
 
+// this is one of the checkpoints we use to convert between positions in chars and render. between two tabs, every character takes up one column, so knowing where each tab is in both of them is enough to convert any position
+struct tabStop {
+    int cx; // the tab's index in chars
+    int rx; // the index in render the tab's spaces start at
+    int end; // the index in render just past its spaces. tabs line up on columns of the screen, which in a row with wide characters aren't the same thing as bytes of render, so we can't work this out from rx
+};
+
+// this is a checkpoint along a row too long to render all at once, saying where the highlighter was and what state it was in every KILO_ROW_MARK bytes or so. a piece of the row can then be rendered and highlighted starting from the checkpoint before it, instead of from the start of the row
+struct rowMark {
+    int cx; // where the checkpoint is in chars. it's always at the start of a character
+    int rx; // the same place in render
+    int col; // and the column of the screen it's drawn at
+    int state; // the editorHlState the highlighter was in there
+};
+
+// a cell of the screen holds the bytes of the character drawn in it, so one that's several bytes long in UTF-8 still fits in one cell
+typedef uint64_t ecell;
+
 // erow here stands for "editor row" and stores a line of text as a pointer to the dynamically-allocated character data and a length. the typedef lets us refer to the type as erow instead of struct erow
 typedef struct erow {
-    int idx; // this will allow each erow to know its own index within the file, which will alow it to examine the previous row's hl_open_comment value
-    int size;
+    struct rowBlock *block; // the block of the row store this row lives in. a row's index within the file is worked out from its block's position, which will alow it to examine the previous row's hl_open_comment value
+    int size; // the number of characters in the row, not counting the gap
     int rsize;
-    char *chars;
+    char *chars; // this is a gap buffer: the text is chars[0..gap) followed by chars[gap + gaplen..size + gaplen), with an unused hole of gaplen bytes in between that sits wherever the last edit happened
+    int gap; // index where the gap starts, which is also the logical position of the gap in the text
+    int gaplen; // how many free bytes the gap holds. inserting at the gap just fills one of them in, so typing only has to allocate when the gap runs out
+    int rcap; // how many bytes have been allocated for render and hl, so that we can reuse them instead of allocating new ones every time the row changes
     char *render;
     unsigned char *hl; //hl here stands for highlight. this is an array of unsigned char values, meaning integers in the range 0 to 255
     int hl_open_comment; // boolean
+    int flags; // a bit field of ROW_ flags
+    struct tabStop *tabs; // where each of the row's tabs is in chars and in render, in order, filled in along with render. rows without tabs don't have any, and their cx and rx are always the same
+    int ntabs;
+    int tabcap;
+    struct rowMark *marks; // the checkpoints along a row with ROW_WINDOWED set, in order
+    int nmarks;
+    int markcap;
+    int rbase; // the index into the whole row's render that render[0] is. it's 0 unless only a window of the row is rendered
+    int cbase; // and the column of the screen that render[0] is drawn at
+    int wfrom, wto; // the checkpoints the window starts and ends at. wto is nmarks if the window goes to the end of the row
 } erow;
 
+// since chars has a gap in it, we can't index it directly anymore. this macro gives us the character at logical position j by skipping over the gap when j is past it
+#define ROW_CHAR(row, j) ((j) < (row)->gap ? (row)->chars[(j)] : (row)->chars[(j) + (row)->gaplen])
+
+// rather than keeping every row in one big array, which has to be moved around whenever a row is inserted or deleted, we keep the rows in a list of blocks of at most KILO_BLOCK_ROWS rows each. inserting or deleting a row only moves the rows inside its own block
+// // a block of a memory-mapped file starts out with rows set to NULL, and only remembers where its lines are in the mapping. its erows get built the first time one of its rows is looked at
+struct rowBlock {
+    erow *rows;
+    int nrows;
+    int cap; // how many rows we've allocated room for in rows
+    int index; // this block's position in E.blocks
+    size_t mapoff; // where the block's first line starts in E.map, for blocks whose rows haven't been built yet
+    size_t maplen; // how many bytes of E.map the block's lines take up, including their line breaks
+    int hl_out; // for a block that hasn't been loaded, whether its last line ends inside a multi-line comment, as worked out by the background highlighter
+    int hl_scanned; // whether the background highlighter has worked out hl_out
+};
+
+// when a file is opened, the part of it that wasn't indexed before the first screen was drawn gets divided into pieces, one for each indexing thread. each thread turns the lines in its piece into blocks of the row store, and when they're all done the editor adds the blocks to the row store in order
+struct indexJob {
+    const char *map; // the mapping the job indexes. it belongs to the buffer that started the job, which might not be the current one by the time the job is done
+    size_t start, end; // the piece of the mapping this job indexes, which always begins at the start of a line and ends at the end of one
+    struct rowBlock **blocks;
+    int nblocks;
+    int done; // set by the thread when it's finished, protected by E.indexlock
+    pthread_t thread;
+};
+
+// a session cache file is a cacheHeader followed by a cacheBlock for each block of the row store, in order. a block starts where the one before it ends, so one length for every KILO_BLOCK_ROWS lines is all we need to find every line again, instead of an offset for each line
+// // the header is a fixed size, but each cacheBlock is written as three variable-length numbers, seven bits to a byte with the top bit set on every byte but the last. a block's length and row count take two bytes each for most files, so a cacheBlock takes five bytes in the file instead of sixteen
+struct cacheHeader {
+    char magic[8]; // KILO_CACHE_MAGIC
+    uint64_t dev, ino, size; // the file the cache was written for. it only gets used for the same file with the same size and modification time, to the nanosecond, since a file can be changed more than once in a second
+    int64_t mtime, mtime_nsec;
+    uint64_t nblocks;
+    uint64_t numrows; // the rows of every block added together, which the blocks read back in have to add up to
+    uint32_t cy, cx, rowoff, coloff; // where the cursor and the window were in the file
+    uint32_t syntax; // one more than the index in HLDB of the filetype the block end states were worked out for, or 0 for none
+    uint32_t pad;
+};
+#define CACHE_SCANNED (1<<0) // the background highlighter had worked out the state the block's last line ends in when the session cache was written
+#define CACHE_HL_OUT (1<<1) // and the block's last line ends inside a multi-line comment
+#define CACHE_BLOCK_MAX 30 // the most bytes a cacheBlock can take in the file, which is ten for each of its numbers
+struct cacheBlock {
+    uint64_t maplen;
+    uint32_t nrows;
+    uint32_t flags; // CACHE_SCANNED and CACHE_HL_OUT
+};
+
+// a match of a search query, given by the row it's on, the index into the row's render where it starts, and its length, which is only different from the query's length for a regex
+struct searchHit {
+    int row;
+    int col;
+    int len;
+};
+
+// a piece of the file a save writes out. it's either a run of E.map that can be copied straight from the file on disk, or text the save copied out of the rows
+struct saveSegment {
+    const char *text; // NULL for a run of E.map
+    size_t mapoff;
+    size_t len;
+};
+
+// a save happens in two steps. first the main thread takes a snapshot of the file, which only has to copy the text that isn't in the memory-mapped file anymore, and then a writer thread writes the snapshot out while the user carries on editing
+struct saveJob {
+    char *path; // the file name to save to
+    char *map; // the buffer's memory-mapped file and its descriptor when the snapshot was taken, which the segments that aren't text are copied out of. the writer only ever looks at these, never at E.map and E.mapfd, since those belong to whichever buffer is current
+    int mapfd;
+    struct saveSegment *segs;
+    int nsegs;
+    int segcap;
+    char **chunks; // the buffers the snapshot copied text into, KILO_SAVE_CHUNK bytes each unless a single row was bigger than that
+    int nchunks;
+    size_t chunkused; // how much of the last chunk is used
+    size_t chunksize;
+    int dirty; // E.dirty when the snapshot was taken. if it's changed by the time the save is done, there are changes the save didn't include
+    int inplace; // set when the file has more than one name, so it has to be written over rather than replaced
+    unsigned long long undo_at; // E.undo_cur when the snapshot was taken
+    long long written; // how many bytes the writer wrote, or -1 if it failed
+    int err; // the errno of the failure
+    int done; // set by the writer when it's finished, protected by E.savelock
+    pthread_t thread;
+    int threaded;
+};
+
+// a list of matches, in the order they appear in the file
+struct searchHits {
+    struct searchHit *v;
+    int n;
+    int cap;
+};
+
+// the matches of one search query. while the user types a query, we keep one of these for each query they've typed so far that the current one starts with, so typing another character only has to check the matches of the last query, and backspacing goes back to the matches we already had
+struct searchLevel {
+    char *query;
+    int qlen;
+    int regex; // whether the query is a regular expression, compiled into re
+    regex_t re;
+    int bad; // set when the query is a regular expression that doesn't compile, which doesn't match anything
+    struct searchHits hits; // the matches in rows 0..scanned
+    int scanned; // how many rows at the start of the file have been searched. the rest get searched in the background while the user isn't typing
+};
+
+// a range of rows searched by one of the search threads, which collects its own list of matches so the threads never have to wait on each other. when they're all done, the lists get added to the level one after the other, which keeps the matches in file order
+struct searchJob {
+    struct searchLevel *l;
+    regex_t re; // each thread compiles its own copy of a regex, since the C library's regexec() takes a lock on the compiled regex while it runs
+    int compiled;
+    int from, to;
+    struct searchHits hits;
+    char *buf; // where rows with tabs get expanded into the way they're rendered
+    int bufcap;
+    pthread_t thread;
+    int threaded;
+};
+
+// the kinds of edit the undo log records. each kind is next to its opposite, so flipping the lowest bit of a kind gives us the edit that undoes it
+enum undoType {
+    UNDO_INSERT = 0, // len bytes of text were put into row at col
+    UNDO_DELETE, // len bytes of text were taken out of row at col
+    UNDO_ROWS_INSERT, // col rows were put in at row. the text holds each of them after its length, as an int, since a row can have a newline in it
+    UNDO_ROWS_DELETE // col rows were taken out at row
+};
+
+// the header of a record in the undo log. the record's text comes right after it in the log, and after that the size of the whole record, which is how undo steps back from one record to the one before it
+struct undoRecord {
+    int type;
+    int step; // set on the first record of each keypress. undo and redo go back and forth a whole step at a time
+    int row, col;
+    int len; // the length of the text
+    int cy, cx; // where the cursor was before the step started, which is where undoing it puts the cursor back
+    int ay, ax; // where the cursor was after the step, which is where redoing it leaves the cursor
+};
+
+// an arena hands out memory from big chunks, one piece after another, and never frees the pieces on their own. everything it handed out goes at once, when the arena is reset
+// // a chunk's memory comes right after its header, which is rounded up to 16 bytes so that the memory starts out lined up the same way malloc()'s does. on most systems the header alone is 24 bytes, which would leave it lined up on only 8
+struct arenaChunk {
+    struct arenaChunk *next;
+    size_t used;
+    size_t cap;
+};
+#define ARENA_HEADER ((sizeof(struct arenaChunk) + 15) & ~(size_t) 15)
+
+struct arena {
+    struct arenaChunk *chunks; // the chunk being handed out from, followed by the ones that have been used up
+};
+
+// this is what the instrumentation measures for each frame that gets drawn. times are in microseconds
+struct frameStats {
+    int keys; // how many keys were handled since the frame before
+    int latency; // from the first of those keys being read to the frame being written out, or 0 if there weren't any keys
+    int process; // handling the keys, which is everything editorProcessKeypress() does apart from waiting for them
+    int syntax; // highlighting rows in editorUpdateSyntax(), on the main thread only
+    int draw; // building the frame in editorDrawRows() and the status and message bars
+    int write; // the write() that sends the frame to the terminal
+    int total; // all of editorRefreshScreen()
+    int bytes; // how many bytes the frame wrote to the terminal
+    int allocs; // how many allocations were made by every thread since the frame before
+};
+
+// a file that's open in the editor. everything the editor does works on the current buffer through the fields of E, so a buffer's editorBuffer only holds its state while some other buffer is the current one
+struct editorBuffer {
+    int numrows;
+    struct rowBlock **blocks;
+    int nblocks;
+    int blockcap;
+    int *blocktree;
+    char *map;
+    int mapfd;
+    size_t mapsize;
+    size_t mapindexed;
+    struct timespec mapmtime;
+    struct arena rowarena;
+    struct indexJob *indexjobs;
+    int nindexjobs;
+    struct saveJob *savejob;
+    time_t lastsave;
+    int hl_frontier;
+    int hl_until;
+    int dirty;
+    char *filename;
+    struct editorSyntax *syntax;
+    struct editorHighlighter *highlighter;
+    char *undo;
+    unsigned long long undo_tail, undo_cur, undo_head, undo_last;
+    unsigned long long undo_saved;
+    int undo_lasttyping;
+    int follow;
+    int followfd;
+    int followwd;
+    off_t followoff;
+    dev_t followdev;
+    ino_t followino;
+    int followpartial;
+};
+
+// a window on the screen, which shows one of the buffers. the windows are stacked one above the other, each with a status bar under it. a window is only a view: two windows on the same buffer each have a cursor and a scroll position of their own, and share the rows and their render and highlighting. like a buffer, the window the cursor is in keeps its state in E
+struct editorWindow {
+    int buf; // the index of the buffer it shows in E.buffers
+    int cx, cy;
+    int rx;
+    int rowoff, coloff;
+    int top; // the line of the terminal its first row of text is on
+    int rows; // how many rows of text it has, not counting its status bar
+    int frame_rowoff, frame_coloff; // rowoff and coloff when it was last drawn into the frame
+};
+
 // a global struct that will contain our editor state
 struct editorConfig {
     int cx, cy; // variables for holding cursor column and row location
     int rx;
     int rowoff; // row offset to keep track of which row of the file the user is currently scrolled to
     int coloff; // like rowoff but for columns
-    int screenrows; // variable for screen height
+    int screenrows; // variable for screen height, which is the height of the window the cursor is in, without its status bar
     int screencols; // variable for screen width
+    int screentop; // the line of the terminal the window's first row is drawn on
+    int termrows; // the height of the whole terminal, which the windows and the message bar share
+    struct editorBuffer *buffers; // every open buffer, in the order they were opened
+    int nbuffers;
+    int curbuf; // the buffer whose state is in E
+    struct editorWindow *windows; // the windows from the top of the screen down
+    int nwindows;
+    int curwin; // the window the cursor is in, whose state is in E
     int numrows;
-    erow *row;
+    struct rowBlock **blocks; // the blocks holding the rows of the file, in order
+    int nblocks;
+    int blockcap;
+    int *blocktree; // a Fenwick tree (binary indexed tree) over the number of rows in each block, 1-indexed, which lets us find the block holding any row and the index of any row in O(log n)
+    char *map; // the contents of the open file, memory-mapped read-only, or NULL if the file was read in with getline()
+    int mapfd; // the file E.map maps, which a save copies the parts of the file that haven't changed from
+    // rows read in line by line keep their text in rowarena. every other piece of a row, the chars of rows that have been edited and every render and hl, comes from the pools: a free list for each power-of-two size class, which freed pieces go back on to be reused. the pools get their memory from slabs, so the allocator is only called for a new chunk every so often
+    struct arena rowarena;
+    struct arena slabs;
+    void *pools[KILO_POOL_CLASSES];
+    struct saveJob *savejob; // the save being written out in the background, or NULL if there isn't one
+    pthread_mutex_t savelock;
+    time_t lastsave; // when the last save or autosave started
+    size_t mapsize;
+    size_t mapindexed; // how many bytes at the start of the mapping we've already split into rows. E.numrows only counts those rows until this reaches mapsize
+    struct timespec mapmtime; // when the mapped file had last been changed as of when we mapped it. if it's been changed since, the rows no longer match what's on the disk, and they don't get written to the session cache
+    struct indexJob *indexjobs; // the indexing threads working on the rest of the mapping, if there are any
+    int nindexjobs;
+    pthread_mutex_t indexlock;
+    // the background highlighter runs on its own thread, and shares the rows with the main thread, so the main thread holds E.lock the whole time it isn't waiting for a key, and the background highlighter only takes it in short bursts in between
+    pthread_mutex_t lock;
+    pthread_cond_t hlcond; // signalled when there's more work for the background highlighter
+    pthread_t hlthread;
+    int hl_frontier; // the first row whose end state the background highlighter still has to check, or INT_MAX when it has nothing to do
+    int hl_until; // the background highlighter keeps going at least this far, even when the rows it's looking at don't change
+    int redraw; // set when something on the screen has changed since it was last drawn, by a key, by the background highlighter, or by work finishing in the background
+    long long lastframe; // when the screen was last drawn, in milliseconds
+    int wakefd[2]; // a pipe that signal handlers and background threads write a byte to, to wake the main thread up from poll()
+    volatile sig_atomic_t winch; // set by the SIGWINCH handler when the terminal has been resized
+    int geomquery; // set while we're waiting for the terminal to say where the cursor is, which is how we find out its size when ioctl() can't tell us. a cursor position report looks just like some function keys, so we only take it for one while we're waiting for one
+    int headless; // set when there's no terminal, which is how the benchmarks run, so that we don't ask it for its size
     int dirty; // tells us whether the file has been changed since opening
     char *filename;
-    char statusmsg[80];
+    char statusmsg[256]; // the message bar only shows as much of it as fits on the screen
     time_t statusmsg_time;
     struct editorSyntax *syntax;
+    struct editorHighlighter *highlighter; // E.syntax compiled into tables for the highlighter
+    struct searchLevel *search; // the matches of the query being searched for and of the queries it was typed from, with the current query's last
+    int nsearch;
+    int searchcap;
+    int search_current; // the index of the match the cursor is on in the current query's hits, or -1 if there isn't one
+    int search_regex; // whether queries are regular expressions, which Ctrl-R switches in the search prompt
+    int match_row, match_col, match_len; // the match the cursor is on, which is drawn over the hl of its row in the HL_MATCH color. match_row is -1 when there isn't one
+    // we keep a copy of what we last drew on the terminal, a character and an attribute for each cell, so each refresh only has to send the parts of the screen that changed
+    ecell *frame_chars;
+    unsigned char *frame_attrs;
+    int frame_rows, frame_cols; // the size of the frame, which is the whole terminal including the status and message bars
+    int frame_valid; // whether the terminal really shows what's in the frame. when it doesn't, the next refresh redraws every line
+    int frame_rowoff, frame_coloff; // E.rowoff and E.coloff when the window was last drawn into the frame
+    int frame_attr; // the attribute the terminal is currently drawing with
+    ecell *line_chars; // the line being drawn, which gets compared with the same line of the frame
+    unsigned char *line_attrs;
     struct termios orig_termios; // here we store the original terminal attributes in a global variable
+    int outflags; // the file status flags stdout had before we made it non-blocking, which it gets back when the editor exits
+    const char *outq; // the part of the last frame the terminal hasn't taken yet. it points into the frame's abuf, which isn't touched again until all of it has been written
+    size_t outlen;
+    char inbuf[4096]; // input we've read from the terminal but haven't handled yet. we read as much as is waiting at once, so a burst of typing takes one read() instead of one per byte
+    int inlen;
+    int inpos;
+    char *paste; // the text of the last bracketed paste
+    int pastelen;
+    int pastecap;
+    // the undo log is a ring of records of the edits that have been made, oldest first. positions in it only ever go up, and are taken modulo KILO_UNDO_BYTES to find the byte they're at. the records from undo_tail to undo_cur are edits that can be undone, and the ones from undo_cur to undo_head are edits that were undone and can be redone
+    char *undo; // the ring, which is allocated the first time something gets recorded
+    unsigned long long undo_tail, undo_cur, undo_head;
+    unsigned long long undo_last; // where the newest record starts, if more of the same edit can still be merged into it, or ULLONG_MAX if it can't
+    unsigned long long undo_saved; // undo_cur when the file was last opened or saved, so undoing or redoing back to there leaves no unsaved changes. ULLONG_MAX once the log can't get back there
+    int undo_step; // set by each keypress, until its first edit gets recorded
+    int undo_typing; // set while the edit being made is typing or deleting a single character, which carries on the run of typing before it instead of starting a step of its own
+    int undo_lasttyping; // whether the newest record was made by typing
+    int undo_replay; // set while undo and redo make their edits, so that they don't get recorded themselves
+    int undo_cy, undo_cx; // where the cursor was when the key being handled was pressed
+    // in follow mode, whatever gets appended to the file is added to the end of the buffer as it's written, like tail -f
+    int follow; // whether the buffer is following its file
+    int followfd; // the file being followed, which the new bytes are read from
+    int followwd; // the inotify watch on it, or -1
+    off_t followoff; // how much of the file is already in the buffer
+    dev_t followdev; // the file the buffer's rows came from. when the file's name stops pointing at it, the file has been rotated or replaced
+    ino_t followino;
+    int followpartial; // whether the file ended partway through a line the last time we read it, so the next bytes carry on the last row
+    int followq; // the inotify instance or kqueue that tells us when a file being followed changes, shared by every buffer, or -1 if we don't have one
+    int nfollow; // how many buffers are following their files
+    int followbehind; // set when a file being followed had more new bytes than we read in one go, so the event loop comes right back for the rest
+    // the instrumentation is off unless KILO_STATS is set in the environment or Ctrl-T turns it on. KILO_STATS names a file the measurements get written to on exit, as JSON if its name ends in .json and as CSV otherwise
+    int stats; // whether we're measuring frames
+    int stats_show; // whether the message bar shows the instrumentation line instead of the status message
+    char *stats_path;
+    FILE *stats_fp; // the file at stats_path. each frame is written to it when it's measured, so it gets every frame without our having to keep them all
+    int stats_json; // whether stats_fp gets JSON rather than CSV
+    struct frameStats frames[KILO_STATS_WINDOW]; // the latest frames measured, in a ring. frame j is at j % KILO_STATS_WINDOW
+    int nframes; // how many frames have been measured in all
+    struct frameStats frame; // the frame being measured now
+    long long firstkey; // when the first key of this frame was read, or 0 if no key has been
+    long long keyat; // when the key being handled now was read, or 0 if we're waiting for one
+    unsigned long lastallocs; // alloc_count when the last frame was written
+    char *cachedir; // the directory KILO_CACHE names, where each big file's session cache is kept, or NULL if there isn't one
 };
 
 struct editorConfig E;
@@ -111,7 +560,29 @@ char *C_HL_keywords[] = {
     "int|", "long|", "double|", "float|", "char|", "unsigned|", "signed|", "void|", NULL
 };
 
+char *PY_HL_extensions[] = { ".py", NULL };
+char *PY_HL_keywords[] = {
+    "and", "as", "assert", "async", "await", "break", "class", "continue", "def", "del", "elif", "else", "except", "finally", "for", "from", "global", "if", "import", "in", "is", "lambda", "nonlocal", "not", "or", "pass", "raise", "return", "try", "while", "with", "yield",
+
+    "True|", "False|", "None|", "int|", "float|", "str|", "bytes|", "list|", "dict|", "set|", "tuple|", "bool|", "self|", NULL
+};
+
+char *RUST_HL_extensions[] = { ".rs", NULL };
+char *RUST_HL_keywords[] = {
+    "as", "break", "const", "continue", "crate", "else", "enum", "extern", "fn", "for", "if", "impl", "in", "let", "loop", "match", "mod", "move", "mut", "pub", "ref", "return", "static", "struct", "trait", "type", "unsafe", "use", "where", "while", "async", "await", "dyn",
+
+    "i8|", "i16|", "i32|", "i64|", "i128|", "isize|", "u8|", "u16|", "u32|", "u64|", "u128|", "usize|", "f32|", "f64|", "bool|", "char|", "str|", "String|", "Self|", "self|", "true|", "false|", NULL
+};
+
+char *GO_HL_extensions[] = { ".go", NULL };
+char *GO_HL_keywords[] = {
+    "break", "case", "chan", "const", "continue", "default", "defer", "else", "fallthrough", "for", "func", "go", "goto", "if", "import", "interface", "map", "package", "range", "return", "select", "struct", "switch", "type", "var",
+
+    "bool|", "byte|", "error|", "float32|", "float64|", "int|", "int8|", "int16|", "int32|", "int64|", "rune|", "string|", "uint|", "uint8|", "uint16|", "uint32|", "uint64|", "uintptr|", "nil|", "true|", "false|", NULL
+};
+
 // HLDB here is our "highlight database"
+// // each entry gets compiled into a set of tables by editorCompileSyntax() the first time it is selected, so adding a language here is all it takes to highlight it
 struct editorSyntax HLDB[] = {
     {
         "c",
@@ -121,22 +592,141 @@ struct editorSyntax HLDB[] = {
         HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
         // the above bit flags will be turned on when highlighting C files
     },
+    {
+        "python",
+        PY_HL_extensions,
+        PY_HL_keywords,
+        "#", NULL, NULL,
+        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+    },
+    {
+        "rust",
+        RUST_HL_extensions,
+        RUST_HL_keywords,
+        "//", "/*", "*/",
+        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+    },
+    {
+        "go",
+        GO_HL_extensions,
+        GO_HL_keywords,
+        "//", "/*", "*/",
+        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+    },
 };
 
 // this is a constant that will store the length of the HLDB array
 #define HLDB_ENTRIES (sizeof(HLDB) / sizeof(HLDB[0]))
 
+// the keywords of a filetype get turned into a lookup table when the filetype is compiled, so that the highlighter doesn't have to go through the whole keywords list at every word
+struct editorKeyword {
+    char *word;
+    int len; // the length of the word, not counting the | that marks a secondary keyword
+    int type; // HL_KEYWORD1 or HL_KEYWORD2
+    int order; // the keyword's position in the keywords list
+};
+
+struct editorKeywordTable {
+    struct editorKeyword *words; // every keyword made only of non-separator characters, sorted by first character and then by length
+    int start[257]; // the keywords starting with character c are words[start[c]] up to words[start[c + 1]]
+    unsigned int lengths[256]; // bit n is set in lengths[c] if a keyword starting with c has length n, with bit 31 standing for every length from 31 up. most words aren't keywords, and this lets us tell that without looking at any of the keywords
+    struct editorKeyword *other; // keywords that have a separator character in them, which can't be found by looking at one word at a time, so these are checked one by one like before
+    int nother;
+};
+
+// the highlighter works like a state machine. it reads a line one byte at a time, and each byte's class together with the current state decides the byte's highlight and the next state
+enum editorHlState {
+    HLS_SEP = 0, // normal text, right after a separator (or at the start of the line)
+    HLS_WORD, // normal text, in the middle of a word
+    HLS_NUMBER, // just after a digit or decimal point that was highlighted as a number
+    HLS_DQUOTE, // inside a string that started with "
+    HLS_SQUOTE, // inside a string that started with '
+    HLS_COMMENT, // inside a multi-line comment
+    HLS_COUNT
+};
+
+// the rest of the line is a single-line comment. a line can end in this state, and a checkpoint can be in it, but nothing goes on from it, so it doesn't need a row of the transition table
+#define HLS_LINE HLS_COUNT
+
+enum editorHlClass {
+    HLC_WORD = 0, // any character that isn't a separator and doesn't have a class of its own
+    HLC_SEP,
+    HLC_DIGIT,
+    HLC_DOT, // . is a separator, but it continues a number
+    HLC_DQUOTE,
+    HLC_SQUOTE,
+    HLC_BACKSLASH,
+    HLC_COUNT,
+    HLC_DELIM = HLC_COUNT // the byte could be the start of a comment delimiter. this class isn't in the transition table, since whether it's really a delimiter depends on the bytes after it
+};
+
+#define HLA_KEYWORD 1 // check whether a keyword starts at this byte
+#define HLA_ESCAPE 2 // a backslash in a string, which makes the byte after it part of the string too
+
+struct editorHlTransition {
+    unsigned char hl; // the editorHighlight value for the byte
+    unsigned char next; // the state after the byte
+    unsigned char action; // one of the HLA_ values, or 0 for none
+};
+
+// this is a filetype compiled into tables for the highlighter
+struct editorHighlighter {
+    unsigned char cls[256]; // the class of each byte, which is HLC_DELIM for bytes that start a comment delimiter
+    unsigned char base[256]; // the class each byte falls back to when it turns out not to be the start of a delimiter
+    unsigned char sep[256]; // whether each byte is a separator
+    struct editorHlTransition trans[HLS_COUNT][HLC_COUNT];
+    char *scs, *mcs, *mce; // the comment delimiters, with the lengths below. a length of 0 means the filetype doesn't have that kind of comment
+    int scs_len, mcs_len, mce_len;
+    struct editorKeywordTable keywords;
+    int built;
+};
+
+struct editorHighlighter HLDB_compiled[HLDB_ENTRIES];
+
 /*** prototypes ***/
 
 // we have to create a function prototype here because we are calling editorSetStatusMessage() in a function above where it is called, which is not supposed to be possible in a language like C that is designed to compile in a single pass through the program
 // // when we call a function in C, the compiler needs to know the arguments and return value of that function, we can tell the compiler this information here near the top of the file
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen();
+int editorStatsLine(char *buf, int size);
+void editorStatsFrame(long long end);
+void editorStatsToggle(void);
 char *editorPrompt(char *prompt, void (*callback)(char *, int));
+void editorIndexPoll(void);
+int editorSearchStep(void);
+void editorSavePoll(void);
+void editorSaveWait(void);
+void editorIndexFinish(void);
+void editorSearchClear(void);
+int getWindowSize(int *rows, int *cols);
+void editorQueryGeometry(void);
+void editorSetGeometry(int rows, int cols);
+void editorScroll(void);
+int editorRowMarkSyntax(erow *row, int in_comment);
+void initEditor(void);
+void editorFreeRow(erow *row);
+void editorUndoRecord(int type, int row, int col, const char *text, int len);
+void editorUndoClear(void);
+int editorRowOnScreen(int at);
+void editorBufferPoll(void);
+void editorEachBuffer(void (*fn)(void));
+void editorBufferSwitch(int b);
+int editorAnyDirty(void);
+void editorLayout(void);
+void editorSplitWindow(void);
+void editorOpenBuffer(char *filename);
+void editorFollowStop(void);
+void editorFollowDrain(void);
+void editorOutputFlush(void);
+void editorOutputDrain(void);
+void editorCacheSave(void);
 
 /*** terminal ***/
 
 void die(const char *s) {
+    // whatever is left of the last frame goes out first, so the clear comes after it
+    editorOutputDrain();
     // clear screen and reposition cursor on exit due to error, but before printing an error, so it's not erased immediately
     write(STDIN_FILENO, "\x1b[2J", 4);
     write(STDIN_FILENO, "\x1b[H", 3);
@@ -149,6 +739,11 @@ void die(const char *s) {
 }
 
 void disableRawMode(void) {
+    // the rest of the last frame gets written out, and stdout goes back to blocking, so that the shell finds it the way it left it
+    editorOutputDrain();
+    fcntl(STDOUT_FILENO, F_SETFL, E.outflags);
+    // <esc>[?2004l turns bracketed paste mode back off
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);
     // run tcsetattr() with those arguments and return an error with die() if it fails
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1) {
         die("tcsetattr");
@@ -159,6 +754,7 @@ void enableRawMode(void) {
     // we use tcgetattr() here to read current attributes into a struct
     // call die() if it fails
     if (tcgetattr(STDIN_FILENO, &E.orig_termios) == -1) die("tcgetattr");
+    E.outflags = fcntl(STDOUT_FILENO, F_GETFL);
     atexit(disableRawMode);
 
     // struct we create
@@ -189,20 +785,250 @@ void enableRawMode(void) {
     // VMIN sets the minimum number of bytes of input before read() can return
     raw.c_cc[VMIN] = 0;
     // VTIME sets the minimum amount of time before read() can return, in tenths of a second
-    raw.c_cc[VTIME] = 1;
+    // // we set it to 0 so read() never waits. the event loop uses poll() to wait for input instead, so it can wait on other things at the same time
+    raw.c_cc[VTIME] = 0;
 
     // here we pass the modified struct to tcsetattr() to write the new terminal attributes back out
     // // TCSAFLUSH argument specifies when to apply the change
     // // // in this case, it waits for all pending output to be written to the terminal, and discards an unread input
     if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1) die("tcsetattr");
+    // <esc>[?2004h turns on bracketed paste mode, where the terminal sends <esc>[200~ before anything the user pastes and <esc>[201~ after it. that lets us insert a paste all at once, and keeps the newlines and tabs in it from being taken for keypresses
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);
+    // stdout is non-blocking, so a slow terminal can never keep us waiting inside write(). when it won't take all of a frame, the rest waits in a queue and the event loop writes it out as the terminal makes room for it
+    // // stdin is usually the same terminal, and so becomes non-blocking too, which is fine since we only read from it once poll() says there's something to read
+    if (E.outflags != -1) fcntl(STDOUT_FILENO, F_SETFL, E.outflags | O_NONBLOCK);
+}
+
+// this gives us the next byte of input in c, reading more from the terminal when we've used up what we read last time. if nothing comes in for KILO_ESC_MS, we give up. like read(), it returns 1 if it got a byte, 0 if it timed out and -1 on an error
+int editorReadByte(char *c) {
+    if (E.inpos == E.inlen) {
+        struct pollfd in = { STDIN_FILENO, POLLIN, 0 };
+        if (poll(&in, 1, KILO_ESC_MS) <= 0) return 0;
+        int nread = read(STDIN_FILENO, E.inbuf, sizeof(E.inbuf));
+        if (nread <= 0) return nread;
+        E.inlen = nread;
+        E.inpos = 0;
+    }
+    *c = E.inbuf[E.inpos++];
+    return 1;
+}
+
+// this tells us whether there's more input waiting to be handled, either already read in or still waiting at the terminal
+int editorInputPending(void) {
+    if (E.inpos < E.inlen) return 1;
+    struct pollfd in = { STDIN_FILENO, POLLIN, 0 };
+    return poll(&in, 1, 0) > 0;
+}
+
+// this writes as much of the output queue as the terminal will take right now, without waiting for it. a partial write just leaves the rest queued
+void editorOutputFlush(void) {
+    while (E.outlen > 0) {
+        ssize_t n = write(STDOUT_FILENO, E.outq, E.outlen);
+        if (n > 0) {
+            E.outq += n;
+            E.outlen -= n;
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return;
+        } else {
+            // any other error means the terminal has gone away, so there's nobody left to draw for
+            E.outlen = 0;
+        }
+    }
+}
+
+// this queues len bytes of output for the terminal and writes what it'll take of them straight away. s has to stay where it is until the queue is empty
+void editorOutput(const char *s, size_t len) {
+    E.outq = s;
+    E.outlen = len;
+    editorOutputFlush();
+}
+
+// this waits until everything queued has been written out, for when whatever we write next has to come after it. the event loop never waits like this
+void editorOutputDrain(void) {
+    while (E.outlen > 0) {
+        editorOutputFlush();
+        if (E.outlen == 0) break;
+        struct pollfd out = { STDOUT_FILENO, POLLOUT, 0 };
+        if (poll(&out, 1, -1) == -1 && errno != EINTR) E.outlen = 0;
+    }
+}
+
+// this reads the text of a bracketed paste into E.paste, up to the <esc>[201~ that ends it
+void editorReadPaste(void) {
+    static const char end[] = "\x1b[201~";
+    int endlen = sizeof(end) - 1;
+    int timeouts = 0;
+    E.pastelen = 0;
+    char c;
+    // the text keeps coming as fast as the terminal can send it, so if it stops for a whole second the end of the paste must have gotten lost, and we take what we have
+    while (timeouts < 10) {
+        int nread = editorReadByte(&c);
+        if (nread == -1 && errno != EAGAIN) die("read");
+        if (nread != 1) {
+            timeouts++;
+            continue;
+        }
+        timeouts = 0;
+        if (E.pastelen == E.pastecap) {
+            E.pastecap = E.pastecap ? E.pastecap * 2 : 4096;
+            E.paste = krealloc(E.paste, E.pastecap);
+            if (E.paste == NULL) die("realloc");
+        }
+        E.paste[E.pastelen++] = c;
+        if (E.pastelen >= endlen && !memcmp(&E.paste[E.pastelen - endlen], end, endlen)) {
+            E.pastelen -= endlen;
+            return;
+        }
+    }
+}
+
+/*** event loop ***/
+
+// this gives us the time in milliseconds, counted from some fixed point in the past. unlike time(), it never jumps when the system clock is changed
+long long editorNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// this is the same clock as editorNow(), in microseconds, which the instrumentation times things with
+long long editorMicros(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// this wakes the main thread up if it's waiting in editorWaitForInput(). background threads call it when they finish something the main thread has to know about. if the pipe is already full, the main thread has plenty of wakeups waiting for it, so we don't mind the write failing
+void editorWake(void) {
+    int saved = errno;
+    if (write(E.wakefd[1], "", 1) == -1) {}
+    errno = saved;
+}
+
+// the terminal sends us SIGWINCH when it's resized. all we can safely do in a signal handler is set a flag and wake up the main thread, which gets the new size itself
+void editorHandleSigwinch(int sig) {
+    (void) sig;
+    E.winch = 1;
+    editorWake();
+}
+
+void editorInitEvents(void) {
+    if (pipe(E.wakefd) == -1) die("pipe");
+    // both ends are non-blocking, so a thread never waits on a full pipe and the main thread can empty it without waiting
+    for (int j = 0; j < 2; j++) fcntl(E.wakefd[j], F_SETFL, fcntl(E.wakefd[j], F_GETFL) | O_NONBLOCK);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = editorHandleSigwinch;
+    sigemptyset(&sa.sa_mask);
+    // SA_RESTART keeps a read() or write() that the signal interrupts going, rather than having it fail with EINTR. poll() fails with EINTR anyway, which the event loop expects
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGWINCH, &sa, NULL) == -1) die("sigaction");
+}
+
+// this gets the new size of the terminal after it's been resized. ioctl() answers straight away, without asking the terminal anything. where it can't, we ask the terminal, and pick up the new size when its answer comes in with the keys
+void editorResize(void) {
+    int rows, cols;
+    E.winch = 0;
+    if (getWindowSize(&rows, &cols) == -1) {
+        editorQueryGeometry();
+        return;
+    }
+    editorSetGeometry(rows, cols);
+}
+
+// this works out how long the event loop can wait before it has something to do even if nothing happens, in milliseconds, or -1 if it can wait forever. that's the time left until the next frame when there's a redraw waiting, the time until the status message goes away, and the time until the next autosave
+int editorNextTimeout(long long now) {
+    long long timeout = -1;
+    // a frame that's still being written out holds back the next one, so until poll() says the terminal has room there's no point waking up to draw
+    if (E.redraw && !E.outlen) timeout = E.lastframe + KILO_FRAME_MS - now;
+    time_t secs = time(NULL);
+    if (E.statusmsg[0] && secs - E.statusmsg_time < 5) {
+        long long t = (long long) (E.statusmsg_time + 5 - secs) * 1000;
+        if (timeout < 0 || t < timeout) timeout = t;
+    }
+    if (KILO_AUTOSAVE > 0 && E.dirty && E.filename && !E.savejob) {
+        long long t = (long long) (E.lastsave + KILO_AUTOSAVE - secs) * 1000;
+        if (t < 0) t = 0;
+        if (timeout < 0 || t < timeout) timeout = t;
+    }
+    // files being followed get checked every so often, and right away when one of them has more waiting to be read
+    if (E.nfollow && (timeout < 0 || KILO_FOLLOW_MS < timeout)) timeout = KILO_FOLLOW_MS;
+    if (E.followbehind) timeout = 0;
+    if (timeout < -1) timeout = 0;
+    return timeout > INT_MAX ? INT_MAX : (int) timeout;
+}
+
+// this is the event loop. it waits until there's a key to read, and handles everything else that happens in the meantime: the terminal being resized, the indexing threads or a save finishing, the background highlighter changing something on the screen, and timers going off. the screen is redrawn at most once every KILO_FRAME_MS, however many changes come in
+void editorWaitForInput(void) {
+    struct pollfd fds[4] = {
+        { STDIN_FILENO, POLLIN, 0 },
+        { 0, POLLIN, 0 },
+        { 0, POLLIN, 0 },
+        { STDOUT_FILENO, POLLOUT, 0 },
+    };
+    fds[1].fd = E.wakefd[0];
+    while (E.inpos == E.inlen) {
+        if (E.winch) editorResize();
+        // every buffer gets checked on, not just the current one, since a buffer's indexing threads, its save and the file it's following carry on when it isn't the current one
+        E.followbehind = 0;
+        editorEachBuffer(editorBufferPoll);
+
+        long long now = editorNow();
+        // while the terminal is still taking the last frame, we don't draw another one behind it. keys keep getting handled in the meantime, and once the terminal catches up, the next frame shows everything they did at once, instead of the terminal being sent every frame in between
+        if (E.redraw && !E.outlen && now - E.lastframe >= KILO_FRAME_MS) {
+            editorRefreshScreen();
+            // a search keeps counting matches in the background until a key is pressed, and the count on the status bar gets updated as it goes
+            if (E.nsearch && editorSearchStep()) E.redraw = 1;
+            now = editorNow();
+        }
+
+        int timeout = editorNextTimeout(now);
+        // while we're waiting, we let go of E.lock so that the background highlighter can get some work done
+        pthread_mutex_unlock(&E.lock);
+        // poll() skips over an fd of -1, so E.followq only gets looked at once something is being followed
+        fds[2].fd = E.followq;
+        // and we only ask whether the terminal has room for more output when there's output waiting for it
+        fds[3].fd = E.outlen ? STDOUT_FILENO : -1;
+        int n = poll(fds, 4, timeout);
+        pthread_mutex_lock(&E.lock);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            die("poll");
+        }
+        // a timer going off always means the screen has to be drawn again
+        if (n == 0) E.redraw = 1;
+        if (fds[1].revents & POLLIN) {
+            char buf[64];
+            while (read(E.wakefd[0], buf, sizeof(buf)) > 0);
+        }
+        if (fds[2].fd != -1 && (fds[2].revents & POLLIN)) editorFollowDrain();
+        if (fds[3].fd != -1 && (fds[3].revents & (POLLOUT | POLLERR | POLLHUP))) editorOutputFlush();
+        if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) return;
+    }
 }
 
 // this function waits for one keypress and returns it
 int editorReadKey(void) {
     int nread;
     char c;
-    while ((nread = read(STDIN_FILENO, &c, 1)) != 1) {
+    // the key we were asked for last time has been handled by now
+    if (E.keyat) {
+        E.frame.process += editorMicros() - E.keyat;
+        E.keyat = 0;
+    }
+    editorWaitForInput();
+    while ((nread = editorReadByte(&c)) != 1) {
         if (nread == -1 && errno != EAGAIN) die("read");
+        if (nread == 0) editorWaitForInput();
+    }
+    // any key can change what's on the screen
+    E.redraw = 1;
+    if (E.stats) {
+        E.keyat = editorMicros();
+        if (!E.firstkey) E.firstkey = E.keyat;
+        E.frame.keys++;
     }
 
     if (c == '\x1b') {
@@ -210,21 +1036,41 @@ int editorReadKey(void) {
         char seq[3];
 
         // each of these read()s will time out after 0.1 seconds, which is long enough for the near instantaneous escape sequences produced by arrow key presses to trigger them, but will otherwise assume the user just pressed the Escape key and return that
-        if (read(STDIN_FILENO, &seq[0], 1) != 1) return '\x1b';
-        if (read(STDIN_FILENO, &seq[1], 1) != 1) return '\x1b';
+        if (editorReadByte(&seq[0]) != 1) return '\x1b';
+        if (editorReadByte(&seq[1]) != 1) return '\x1b';
 
         if (seq[0] == '[') {
             if (seq[1] >= '0' && seq[1] <= '9') {
-                if (read(STDIN_FILENO, &seq[2], 1) != 1) return '\x1b';
+                // the number in the sequence can be more than one digit long, like the 200 in <esc>[200~, so we keep reading digits until the character that ends it
+                int n = seq[1] - '0';
+                do {
+                    if (editorReadByte(&seq[2]) != 1) return '\x1b';
+                    if (seq[2] >= '0' && seq[2] <= '9') n = n * 10 + seq[2] - '0';
+                } while (seq[2] >= '0' && seq[2] <= '9' && n < 1000);
+                // <esc>[rows;colsR is the terminal answering editorQueryGeometry(). it isn't a key, so once we've taken the size from it we go on to the next key
+                if (seq[2] == ';' && E.geomquery) {
+                    int cols = 0;
+                    char d;
+                    while (editorReadByte(&d) == 1 && d >= '0' && d <= '9' && cols < 1000) cols = cols * 10 + d - '0';
+                    if (d == 'R' && n > 0 && cols > 0) {
+                        E.geomquery = 0;
+                        editorSetGeometry(n, cols);
+                        return editorReadKey();
+                    }
+                    return '\x1b';
+                }
                 if (seq[2] == '~') {
-                    switch (seq[1]) {
-                        case '1': return HOME_KEY;
-                        case '3': return DEL_KEY;
-                        case '4': return END_KEY;
-                        case '5': return PAGE_UP;
-                        case '6': return PAGE_DOWN;
-                        case '7': return HOME_KEY;
-                        case '8': return END_KEY;
+                    switch (n) {
+                        case 1: return HOME_KEY;
+                        case 3: return DEL_KEY;
+                        case 4: return END_KEY;
+                        case 5: return PAGE_UP;
+                        case 6: return PAGE_DOWN;
+                        case 7: return HOME_KEY;
+                        case 8: return END_KEY;
+                        case 200:
+                            editorReadPaste();
+                            return PASTE_KEY;
                     }
                 }
             } else {
@@ -250,301 +1096,1237 @@ int editorReadKey(void) {
     }
 }
 
-// this function is just fallback method in case the getWindowSize() method doesn't work on some system
-int getCursorPosition(int *rows, int *cols) {
-    char buf[32];
-    unsigned int i = 0;
-
-    if (write(STDOUT_FILENO, "\x1b[6n", 4) != 4) return -1;
-
-    while (i < sizeof(buf) - 1) {
-        if (read(STDIN_FILENO, &buf[i], 1) != 1) break;
-        if (buf[i] == 'R') break;
-        i++;
-    }
-    buf[i] ='\0';
-
-    // first we make sure it responded with an escape sequence
-    if (buf[0] != '\x1b' || buf[1] != '[') return -1;
-    // then we pass a pointer to the third character if buf to sccanf(), skipping '\x1b' and '[', so we are passing a string of the form 24;80 to sccanf(). We are also passing it the string %d;%d which tells it to parse two integers separated by a ;, and we put those values into the rows and cols variables
-    if (sscanf(&buf[2], "%d;%d", rows, cols) != 2) return -1;
-
-    return 0;
-}
-
 int getWindowSize(int *rows, int *cols) {
     struct winsize ws;
 
     // on success, ioctl() will place the number of columns and rows of the terminal into the given winsize struct
     // another possible error is that the values returned are 0, so we check for that as well
     // // if the call to ioctl succeeded, we pass the values back by setting the int references that were passed into the function, this is a common approach to having functions return multiple values in C and allows you to use return value to indicate success or failure
-    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
-        // if ioctl() doesn't work properly, as may be the case on some systems, we move the cursor to the bottom-right of the screen, then use escape sequences that let us query the the position of the cursor. this code moves the cursor to the bottom-right of the screen
-        if (write(STDOUT_FILENO, "\x1b[999C\x1b[999B", 12) != 12) return -1;
-        return getCursorPosition(rows, cols);
-        // return -1; // i think i left this here by mistake
-    } else {
-        *cols = ws.ws_col;
-        *rows = ws.ws_row;
-        return 0;
-    }
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) return -1;
+    *cols = ws.ws_col;
+    *rows = ws.ws_row;
+    return 0;
 }
 
-/*** syntax highlighting ***/
-
-int is_separator(int c) {
-    // strchr() looks for the first occurrence of a character in a string, then returns a pointer to the matching character in the string. if the string doesn't contain the character, it returns NULL
-    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[]", c) != NULL;
+// if ioctl() doesn't work properly, as may be the case on some systems, we move the cursor to the bottom-right of the screen, then use escape sequences that let us query the the position of the cursor. we don't wait for the answer, which comes in like a key would some time later, and editorReadKey() hands it to editorSetGeometry() when it does
+// // the question has to come after whatever is left of the last frame, or the cursor would move in the middle of it
+void editorQueryGeometry(void) {
+    editorOutputDrain();
+    if (write(STDOUT_FILENO, "\x1b[999C\x1b[999B\x1b[6n", 16) == 16) E.geomquery = 1;
 }
 
-void editorUpdateSyntax(erow *row) {
-    // first we realloc() the needed memory, since the row might be bigger than the last time we highlighted it, or it could be a new row
-    // // note that the size of the hl array is the same as the size of the render array, so we use rsize as the amount of memory to allocate
-    row->hl = realloc(row->hl, row->rsize);
-    // we use memset to set all characters to HL_NORMAL by default, before looping through the characters and setting the digits to HL_NUMBER
-    memset(row->hl, HL_NORMAL, row->rsize);
-
-    // if no filetype is set, we return immediately after memset()ing the entire line to HL_NORMAL
-    if (E.syntax == NULL) return;
-
-    // we make keywords an alias for E.syntax->keywords for similar reasons to doing so for scs
-    char **keywords = E.syntax->keywords;
-
-    // we make scs an alias for E.syntax->singleline_comment_start for easier typing and better readability
-    char *scs = E.syntax->singleline_comment_start;
-    // we now do the same for multi-line comment start and end
-    char *mcs = E.syntax->multiline_comment_start;
-    char *mce = E.syntax->multiline_comment_end;
-
-    // we set scs_len to the length of the string, or 0 if the string is NULL. this lets us use scs_len as a boolean to know whether we should highlight single-line comments
-    int scs_len = scs ? strlen(scs) : 0;
-    int mcs_len = mcs ? strlen(mcs) : 0;
-    int mce_len = mce ? strlen(mce) : 0;
-
-    // we initialize prev_sep to 1 (meaning true) because we consider the beginning of hte line to be a separator. without this, numbers at the very beginning of the line wouldn't be highlighted
-    int prev_sep = 1;
-    // in_string will track whether we're currently inside of a string and allow us to keep highlighting the current character as a string until we hit the closing quote
-    int in_string = 0;
-    // we initiliaze in_comment here to true if the previous row has an unclosed multi-line comment. if so, then the current row will start out being highlighted as a multi-line comment
-    int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment); // will track if we're in a multi-line comment, not needed for single line comments
-
-    // changing this for-loop to a while-loop allows us to consume multiple characters in each iteration, though we'll still only consume one character a time when processing numbers
-    int i = 0;
-    while (i < row->rsize) {
-        char c = row->render[i];
-        // prev_hl is set to the highlight type of the previous character
-        unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
-
-        // this if-statement checks scs_len and also makes sure we're not in a string, since we're placing this code above the string highlighting code, and order matters a lot for highlighting purposes
-        // we add && !in_comment to make sure that single-line comments are not recognized within multi-line comments
-        if (scs_len && !in_string && !in_comment) {
-            // this if statement checks if the character is the start of a single-line comment
-            if (!strncmp(&row->render[i], scs, scs_len)) {
-                // if the character is the start of a single-line comment, then we memset() the rest of the line with HL_COMMENT and break out of the syntax highlighting loop, and the line is done being highlighted
-                memset(&row->hl[i], HL_COMMENT, row->rsize - i);
-                break;
-            }
-        }
-
-        // both mcs and mce must be non-NULL strings of length greater than 0 to trigger this if-statement and turn on multi-comment highlighting, and we also havet to be sure we're not in a string because /* in a string won't start a comment in most (all) languages
-        if (mcs_len && mce_len && !in_string) {
-            if (in_comment) {
-                // if we're currently in a multi-line comment then we can safely highlight the current character with HL_MLCOMMENT
-                row->hl[i] = HL_MLCOMMENT;
-                // then we check if we're at the end of a multi-line comment by using strncmp() with mce
-                if (!strncmp(&row->render[i], mce, mce_len)) {
-                    // if we are at the end of a multi-line comment then we highlight the whole mce string with HL_MLCOMMENT
-                    memset(&row->hl[i], HL_MLCOMMENT, mce_len);
-                    // then we increment i by the length of the comment to "consume" it
-                    i += mce_len;
-                    // we set in_comment to false
-                    in_comment = 0;
-                    // we consider */ that marks the end of a multi-line comment to be a separator and continue
-                    prev_sep = 1;
-                    continue;
-                } else {
-                    // if we're not at the end of the multi-line comment then we increment i by 1 to "consume" the character and continue
-                    i++;
-                    continue;
-                }
-            // if we're not currently in a multi-line comment then we use strncmp() with mcs to see if we're at the beginning of one
-            } else if (!strncmp(&row->render[i], mcs, mcs_len)) {
-                // if we're at the beginning of a multi-line comment then we use memset() to highlight the whole mcs string with HL_MLCOMMENT
-                memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
-                // then we "consume" the mcs string by incrementing i by the mcs string's length
-                i += mcs_len;
-                // then we set in_comment to true so we can end up in the first clause of this if-statement for the next character
-                in_comment = 1;
-                continue;
-            }
-        }
+// this is where the size of the terminal changes. the windows get shared out over the new size, the frame is drawn again from scratch, and the window the cursor is in is scrolled so the cursor is still on the screen. the other windows get scrolled when they're drawn
+void editorSetGeometry(int rows, int cols) {
+    E.termrows = rows;
+    E.screencols = cols;
+    editorLayout();
+    editorScroll();
+}
 
-        if (E.syntax->flags & HL_HIGHLIGHT_STRINGS) {
-            // if in_string is set then we know the current character can be highlighted with HL_STRING
-            if (in_string) {
-                row->hl[i] = HL_STRING;
-                // here we account for escape quotes, because in most programming languages, \' and \" don't close strings
-                if (c == '\\' && i + 1 < row->rsize) {
-                    row->hl[i + 1] = HL_STRING;
-                    i += 2;
-                    continue;
-                }
-                // we set in_string to a double or single quote so that we know which one closes the string, so if we come across the closing quote, we set to in_string to 0
-                if (c == in_string) in_string = 0;
-                // we increment i to "consume" the current character
-                i++;
-                // we consider the closing quote to be a separator so we set prev_sep to 1
-                prev_sep = 1;
-                // then we continue out of the current loop iteration
-                continue;
-            } else {
-                // if we're not currently in a string, then we have to check if we're at the beginning of one by checking for a double or single quote
-                if (c == '"' || c == '\'') {
-                    // if we find that we are in a string, we store the quote in in_string
-                    in_string = c;
-                    // then we highlight it with HL_STRING
-                    row->hl[i] = HL_STRING;
-                    // then we "consume" it by iterating i
-                    i++;
-                    continue;
-                }
-            }
-        }
+/*** memory ***/
+
+// this hands out n bytes from an arena, starting a new chunk when the current one doesn't have room. a piece bigger than a whole chunk gets a chunk of its own
+void *arenaAlloc(struct arena *a, size_t n) {
+    struct arenaChunk *c = a->chunks;
+    if (!c || c->used + n > c->cap) {
+        size_t cap = n > KILO_ARENA_CHUNK ? n : KILO_ARENA_CHUNK;
+        c = kmalloc(ARENA_HEADER + cap);
+        if (c == NULL) die("malloc");
+        c->next = a->chunks;
+        c->used = 0;
+        c->cap = cap;
+        a->chunks = c;
+    }
+    void *p = (char *) c + ARENA_HEADER + c->used;
+    c->used += n;
+    return p;
+}
 
-        // to highlight a digit with HL_NUMBER we now require the previous character to be a separator, or to also be highlighted with HL_NUMBER
-        // we're also accounting for decimals here by highlighting a '.' that comes after a character we just highlighted as a number
-        if (E.syntax->flags & HL_HIGHLIGHT_NUMBERS) {
-            // the above if-statement checks to see if numbers should be highlighted for the current filetype
-            if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) || (c == '.' && prev_hl == HL_NUMBER)) {
-                row->hl[i] = HL_NUMBER;
-                // when we decide to highlight the current character a certain way, we increment i to "consume" that character, set prev_sep to 0 to indicate that we're in the middle of highlighting something, and then continue the loop
-                i++;
-                prev_sep = 0;
-                continue;
-            }
-        }
+// this frees everything the arena ever handed out, one chunk at a time
+void arenaReset(struct arena *a) {
+    while (a->chunks) {
+        struct arenaChunk *next = a->chunks->next;
+        free(a->chunks);
+        a->chunks = next;
+    }
+}
 
-        // keywords require a separator before and after the word to avoid highlighting the middle of certain words etc, so we check that a separator comes before the word here
-        if (prev_sep) {
-            int j;
-            for (j = 0; keywords[j]; j++) {
-                int klen = strlen(keywords[j]); // here we store the length of the keyword
-                int kw2 = keywords[j][klen - 1] == '|'; // here we store whether it's a secondary keyword
-                if (kw2) klen--; // if it's a secondary keyword, we decrement klen to account for the extraneous | pipe character
-
-                // we use strncmp() to check if the keyword exists at our current position in the text, and we also check to see if a separator comes after the keyword. because \0 is considered a separator, this also works if the keyword is at the very end of the line
-                if (!strncmp(&row->render[i], keywords[j], klen) && is_separator(row->render[i + klen])) {
-                    // if all those conditions are satisfied, then we use memset() to highlight the whole keyword at once, with color depending on the value of kw2
-                    memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
-                    // then we consume the entire keyword, incrementing i by its length
-                    i += klen;
-                    break; // we break instead of continuing because we are in an inner loop
-                }
-            }
+// this gives us the size class a piece of n bytes comes from, where class c holds pieces of KILO_POOL_MIN << c bytes
+int poolClass(size_t n) {
+    int c = 0;
+    while ((size_t) KILO_POOL_MIN << c < n) c++;
+    return c;
+}
 
-            // we check if the loop was broken out of by seeing if it got to the terminating NULL value, and if so then we continue
-            if (keywords[j] != NULL) {
-                prev_sep = 0;
-                continue;
-            }
-        }
+// this is how many bytes a piece asked for with n really has room for. callers use it to make the most of the piece they get
+size_t poolSize(size_t n) {
+    return n > KILO_POOL_MAX ? n : (size_t) KILO_POOL_MIN << poolClass(n);
+}
 
-        // if we end up not highlighting the previous character, then we end up here where we set prev_sep according to whether the current character is a separator and increment i to consume the character. the memset() we did at the top of the function means that an unhighlighted character will have a value of HL_NORMAL in hl
-        prev_sep = is_separator(c);
-        i++;
+// this hands out a piece of at least n bytes, reusing a freed one of its size class if there is one. the slabs only ever hand out whole size classes, which are all multiples of 16 bytes, and a chunk's memory starts on 16 bytes too, so every piece is lined up on 16 bytes, which is plenty to hold the free list's pointers
+void *poolAlloc(size_t n) {
+    if (n > KILO_POOL_MAX) {
+        void *p = kmalloc(n);
+        if (p == NULL) die("malloc");
+        return p;
     }
+    int c = poolClass(n);
+    void *p = E.pools[c];
+    if (p) {
+        E.pools[c] = *(void **) p;
+        return p;
+    }
+    return arenaAlloc(&E.slabs, (size_t) KILO_POOL_MIN << c);
+}
 
-    int changed = (row->hl_open_comment != in_comment);
-    // here we set the current row's hl_open_comment value to whatever in_comment was left in after the entire row was processed
-    row->hl_open_comment = in_comment;
-    // here we check if the value of this line's hl_open_comment variable changed
-    if (changed && row->idx + 1 < E.numrows) {
-        // if hl_open_comment changed then the change will propagate throughout the file until one of them is unchanged, at which point we'd know that all the lines after that one are unchanged as well
-        editorUpdateSyntax(&E.row[row->idx + 1]);
+// this gives back a piece that was asked for with n bytes. a freed piece holds the pointer to the next free piece of its class in its first bytes
+void poolFree(void *p, size_t n) {
+    if (p == NULL) return;
+    if (n > KILO_POOL_MAX) {
+        free(p);
+        return;
     }
+    int c = poolClass(n);
+    *(void **) p = E.pools[c];
+    E.pools[c] = p;
 }
 
-int editorSyntaxToColor(int hl) {
-    switch (hl) {
-        // we're handling HL_NORMAL separately so we don't include it here
-        case HL_COMMENT:
-        case HL_MLCOMMENT: return 36; // both single and multi-line comments will be rendered in cyan
-        case HL_KEYWORD1: return 33; // keywords defined here will render yellow
-        case HL_KEYWORD2: return 31; // keywords defined here will render red
-        case HL_STRING: return 35; // any string enclosed by quotes will be rendered magenta
-        case HL_NUMBER: return 32; // any number will be rendered green
-        case HL_MATCH: return 34; // any match to a search query will be rendered blue
-        default: return 37; // anything else will be rendered white
+// this is realloc() for pieces from the pools. a piece that grows without leaving its size class stays where it is
+void *poolRealloc(void *p, size_t old, size_t n) {
+    if (p == NULL) return poolAlloc(n);
+    if (poolSize(old) >= n && (old > KILO_POOL_MAX) == (n > KILO_POOL_MAX)) return p;
+    if (old > KILO_POOL_MAX && n > KILO_POOL_MAX) {
+        p = krealloc(p, n);
+        if (p == NULL) die("realloc");
+        return p;
     }
+    void *q = poolAlloc(n);
+    memcpy(q, p, old < n ? old : n);
+    poolFree(p, old);
+    return q;
 }
 
-// this function will try to match the current filename to one of the filematch fields in HLDB. if one matches, it'll set E.syntax to that filetype
-void editorSelectSyntaxHighlight(void) {
-    // we set E.syntax to NULL first so that if there is no filename, then there is no filetype
-    E.syntax = NULL;
-    if (E.filename == NULL) return;
+// this throws away the text of every row at once: the arena and the slabs are freed chunk by chunk, and the pools start out empty again
+void poolReset(void) {
+    arenaReset(&E.rowarena);
+    arenaReset(&E.slabs);
+    memset(E.pools, 0, sizeof(E.pools));
+}
 
-    // strrchr() returns a pointer to the last occurrence of a character in a string
-    // if there is no extension, then ext will be NULL
-    char *ext = strrchr(E.filename, '.');
+/*** utf-8 ***/
 
-    // we loop through each editorSyntax struct in the HLDB array, and for each of those we loop through each pattern in its filematch array
-    for (unsigned int j = 0; j < HLDB_ENTRIES; j++) {
-        struct editorSyntax *s = &HLDB[j];
-        unsigned int i = 0;
-        while (s->filematch[i]) {
-            int is_ext = (s->filematch[i][0] == '.');
-            // strcmp() returns 0 if two given strings are equal
-            // if the pattern stats with a . then it's a file extension pattern and we use strmp() to see if the filename ends with that extension. if it's not a file extension pattern then we just check to see if the pattern exists anywhere in the filename, using strstr(). 
-            if ((is_ext && ext && !strcmp(ext, s->filematch[i])) || (!is_ext && strstr(E.filename, s->filematch[i]))) {
-                // if the filename matched according to those rules, then we set E.syntax to the current editorSyntax struct, and return
-                E.syntax = s;
-                
-                int filerow;
-                // in order to update the highlighting for the entire file after setting E.syntax, we loop through each row in the file and call editorUpdateSyntax() on it. this ensures that highlighting immediately changes when the filetype changes
-                for (filerow = 0; filerow < E.numrows; filerow++) {
-                    editorUpdateSyntax(&E.row[filerow]);
-                }
+// a byte that continues a UTF-8 sequence rather than starting one looks like 10xxxxxx
+#define UTF8_CONT(c) (((unsigned char) (c) & 0xC0) == 0x80)
 
-                return;
-            }
-            i++;
-        }
-    }
+// this tells us whether len bytes at s are all ASCII. that's true of most rows of most files, which can then be drawn a byte to a column with no decoding at all. every byte that isn't ASCII has its top bit set, so we OR the bytes together a vector at a time and look at the top bits at the end
+int editorIsAscii(const char *s, int len) {
+    int i = 0;
+#if defined(__AVX2__)
+    __m256i acc = _mm256_setzero_si256();
+    for (; i + 32 <= len; i += 32) acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i *) &s[i]));
+    if (_mm256_movemask_epi8(acc)) return 0;
+#elif defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= len; i += 16) acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *) &s[i]));
+    if (_mm_movemask_epi8(acc)) return 0;
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    uint8x16_t acc = vdupq_n_u8(0);
+    for (; i + 16 <= len; i += 16) acc = vorrq_u8(acc, vld1q_u8((const uint8_t *) &s[i]));
+    if (vmaxvq_u8(acc) & 0x80) return 0;
+#endif
+    unsigned char bits = 0;
+    for (; i < len; i++) bits |= (unsigned char) s[i];
+    return !(bits & 0x80);
 }
 
-/*** row operations ***/
-
-// this function converts a chars index into a render index.
-int editorRowCxToRx(erow *row, int cx) {
-    int rx = 0;
-    int j;
-
-    // for each character, if it's a tab we use rx % KILO_TAB_STOP to find out how many columns we are to the right of the last tab stop, then subtract that from KILO_TAB_STOP - 1 ti find out how many columns we are to the left of the next tab stop. we add that amount to rx to get just to the left of the next tab stop, and then the unconditional rx++ statement gets us right on the next tab stop. This works even if we are currently on a tab stop.
-    for (j = 0; j < cx; j++) {
-        if (row->chars[j] == '\t') {
-            rx += (KILO_TAB_STOP - 1) - (rx % KILO_TAB_STOP);
+// this decodes the UTF-8 character at the start of the len bytes at s into cp, and returns how many bytes it takes up. a byte that doesn't start a valid sequence is taken on its own, with cp set to -1
+int editorUtf8Decode(const char *s, int len, int *cp) {
+    unsigned char c = s[0];
+    int n, min;
+    if (c < 0x80) {
+        *cp = c;
+        return 1;
+    } else if ((c & 0xE0) == 0xC0) {
+        n = 2; min = 0x80; *cp = c & 0x1F;
+    } else if ((c & 0xF0) == 0xE0) {
+        n = 3; min = 0x800; *cp = c & 0x0F;
+    } else if ((c & 0xF8) == 0xF0) {
+        n = 4; min = 0x10000; *cp = c & 0x07;
+    } else {
+        *cp = -1;
+        return 1;
+    }
+    if (n > len) {
+        *cp = -1;
+        return 1;
+    }
+    for (int j = 1; j < n; j++) {
+        if (!UTF8_CONT(s[j])) {
+            *cp = -1;
+            return 1;
         }
-        rx++;
+        *cp = (*cp << 6) | (s[j] & 0x3F);
     }
-    return rx;
+    // an overlong encoding, a surrogate or anything past the last code point isn't valid UTF-8 either
+    if (*cp < min || (*cp >= 0xD800 && *cp <= 0xDFFF) || *cp > 0x10FFFF) {
+        *cp = -1;
+        return 1;
+    }
+    return n;
 }
 
-int editorRowRxToCx(erow *row, int rx) {
-    int cur_rx = 0;
-    int cx;
-    // to convert an rx to a cx we reverse the function for doing the opposite. we loop through the chars string, calculating current rx value (cur_rx) as we go. we want to stop when cur_rx hits the given rx value and return cx
-    for (cx = 0; cx < row->size; cx++) {
-        if (row->chars[cx] == '\t') {
-            cur_rx += (KILO_TAB_STOP - 1) - (cur_rx % KILO_TAB_STOP);
-        }
-        cur_rx++;
+// the ranges of code points that take up no columns, which are mostly combining marks that are drawn on top of the character before them, and the ones that take up two, which are mostly CJK characters and emoji. everything else takes up one
+struct charRange {
+    int lo, hi;
+};
 
-        // this return statement should handle all rx values that are valid indexes into render
-        if (cur_rx > rx) return cx;
+const struct charRange zero_width[] = {
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF}, {0x05C1, 0x05C2}, {0x05C4, 0x05C5}, {0x05C7, 0x05C7},
+    {0x0610, 0x061A}, {0x064B, 0x065F}, {0x0670, 0x0670}, {0x06D6, 0x06DC}, {0x06DF, 0x06E4}, {0x06E7, 0x06E8}, {0x06EA, 0x06ED},
+    {0x0711, 0x0711}, {0x0730, 0x074A}, {0x07A6, 0x07B0}, {0x0900, 0x0902}, {0x093A, 0x093A}, {0x093C, 0x093C}, {0x0941, 0x0948},
+    {0x094D, 0x094D}, {0x0951, 0x0957}, {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E}, {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF},
+    {0x200B, 0x200F}, {0x202A, 0x202E}, {0x2060, 0x2064}, {0x20D0, 0x20FF}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF},
+    {0xE0100, 0xE01EF},
+};
+
+const struct charRange double_width[] = {
+    {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC}, {0x23F0, 0x23F0}, {0x23F3, 0x23F3}, {0x25FD, 0x25FE},
+    {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267F, 0x267F}, {0x2693, 0x2693}, {0x26A1, 0x26A1}, {0x26AA, 0x26AB}, {0x26BD, 0x26BE},
+    {0x26C4, 0x26C5}, {0x26CE, 0x26CE}, {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5}, {0x26FA, 0x26FA},
+    {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B}, {0x2728, 0x2728}, {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755},
+    {0x2757, 0x2757}, {0x2795, 0x2797}, {0x27B0, 0x27B0}, {0x27BF, 0x27BF}, {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55},
+    {0x2E80, 0x303E}, {0x3041, 0x4DBF}, {0x4E00, 0xA4CF}, {0xA960, 0xA97F}, {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19},
+    {0xFE30, 0xFE6F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE4}, {0x17000, 0x18AFF}, {0x1B000, 0x1B2FF}, {0x1F004, 0x1F004},
+    {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F251}, {0x1F300, 0x1F64F}, {0x1F680, 0x1F6FF},
+    {0x1F7E0, 0x1F7EB}, {0x1F90C, 0x1F9FF}, {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+};
+
+// this looks for cp in a sorted table of ranges with a binary search
+int editorInRanges(int cp, const struct charRange *r, int n) {
+    int lo = 0, hi = n - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (cp < r[mid].lo) hi = mid - 1;
+        else if (cp > r[mid].hi) lo = mid + 1;
+        else return 1;
+    }
+    return 0;
+}
+
+// this tells us whether a character can't be drawn as it is. control characters, and bytes that aren't valid UTF-8, get drawn as a single printable character with inverted colors instead
+int editorCharIsControl(int cp) {
+    return cp < 0x20 || cp == 0x7F || (cp >= 0x80 && cp < 0xA0);
+}
+
+// this gives us how many columns the character at s takes up on the screen in w, and returns how many bytes it is, like editorUtf8Decode(). characters we can't draw as they are take up the one column of what we draw in their place
+int editorGlyph(const char *s, int len, int *cp, int *w) {
+    int n = editorUtf8Decode(s, len, cp);
+    if (editorCharIsControl(*cp)) *w = 1;
+    else if (*cp < 0x300) *w = 1;
+    else if (editorInRanges(*cp, zero_width, sizeof(zero_width) / sizeof(zero_width[0]))) *w = 0;
+    else if (editorInRanges(*cp, double_width, sizeof(double_width) / sizeof(double_width[0]))) *w = 2;
+    else *w = 1;
+    return n;
+}
+
+/*** row store ***/
+
+// this rebuilds the Fenwick tree from scratch. we only need to do this when a block is added or removed, which happens once every few hundred row insertions or deletions, so its O(number of blocks) cost gets spread out over all of them
+void rowStoreRebuildTree(void) {
+    E.blocktree = krealloc(E.blocktree, sizeof(int) * (E.blockcap + 1));
+    E.blocktree[0] = 0;
+    for (int b = 1; b <= E.nblocks; b++) E.blocktree[b] = E.blocks[b - 1]->nrows;
+    // each node adds its partial sum into its parent, which builds the whole tree in one pass
+    for (int b = 1; b <= E.nblocks; b++) {
+        int parent = b + (b & -b);
+        if (parent <= E.nblocks) E.blocktree[parent] += E.blocktree[b];
+    }
+}
+
+// this adds delta to the row count of block b in the Fenwick tree
+void rowStoreTreeAdd(int b, int delta) {
+    for (b++; b <= E.nblocks; b += b & -b) E.blocktree[b] += delta;
+}
+
+// this returns the number of rows in all of the blocks before block b
+int rowStoreTreePrefix(int b) {
+    int sum = 0;
+    for (; b > 0; b -= b & -b) sum += E.blocktree[b];
+    return sum;
+}
+
+// this finds the block that holds row at, and the row's offset inside that block. we walk down the Fenwick tree, skipping over whole groups of blocks as long as all their rows come before at. row E.numrows, one past the end, is placed at the end of the last block so that rows can be appended there
+int rowStoreFind(int at, int *off) {
+    int b = 0;
+    int step = 1;
+    while (step * 2 <= E.nblocks) step *= 2;
+    for (; step; step /= 2) {
+        if (b + step <= E.nblocks && E.blocktree[b + step] <= at) {
+            b += step;
+            at -= E.blocktree[b];
+        }
+    }
+    if (b == E.nblocks) {
+        b = E.nblocks - 1;
+        at = E.blocks[b]->nrows;
+    }
+    *off = at;
+    return b;
+}
+
+// this finds the end of the line starting at p in the memory-mapped file, gives us its length in len, and returns where the next line starts. like editorOpen() does for lines read with getline(), we strip off the newline or carriage return at the end of the line
+char *editorMapLine(char *p, char *end, int *len) {
+    char *nl = memchr(p, '\n', end - p);
+    char *next = nl ? nl + 1 : end;
+    int n = next - p;
+    while (n > 0 && (p[n - 1] == '\n' || p[n - 1] == '\r')) n--;
+    *len = n;
+    return next;
+}
+
+// this tells us whether a block's last row ends inside a multi-line comment
+int rowBlockEndState(struct rowBlock *block) {
+    if (block->rows) return block->nrows ? block->rows[block->nrows - 1].hl_open_comment : 0;
+    return block->hl_out;
+}
+
+int editorHighlight(const char *text, int len, unsigned char *hl, int in_comment);
+int editorHighlightState(const char *text, int len, int in_comment);
+
+// this fills in a row of block whose len characters are at chars, without rendering it. flags says where chars is
+void rowStoreInitRow(erow *row, struct rowBlock *block, char *chars, int len, int flags) {
+    row->block = block;
+    row->size = len;
+    row->chars = chars;
+    row->gap = len;
+    row->gaplen = 0;
+    row->rsize = 0;
+    row->rcap = 0;
+    row->render = NULL;
+    row->hl = NULL;
+    row->tabs = NULL;
+    row->ntabs = 0;
+    row->tabcap = 0;
+    row->marks = NULL;
+    row->nmarks = 0;
+    row->markcap = 0;
+    row->rbase = row->cbase = 0;
+    row->wfrom = -1;
+    row->hl_open_comment = 0;
+    row->flags = flags;
+}
+
+// this builds the erows of a block that so far only knows where its lines are in the memory-mapped file. the rows point straight into the mapping, and their render and hl are left for editorUpdateRow() to fill in when the row is first drawn
+void rowBlockLoad(struct rowBlock *block) {
+    if (block->rows) return;
+    block->cap = block->nrows;
+    block->rows = kmalloc(sizeof(erow) * block->cap);
+
+    char *p = &E.map[block->mapoff];
+    char *end = p + block->maplen;
+    // if the background highlighter has already been through this block, we know the state its first line starts in, so we can work out the state of each of its rows right away. otherwise they start out as 0 and the background highlighter fixes them when it gets here
+    int in_comment = 0;
+    int known = block->hl_scanned && (block->index == 0 || E.blocks[block->index - 1]->hl_scanned);
+    if (known && block->index > 0) in_comment = rowBlockEndState(E.blocks[block->index - 1]);
+    for (int j = 0; j < block->nrows; j++) {
+        int len;
+        char *next = editorMapLine(p, end, &len);
+
+        erow *row = &block->rows[j];
+        rowStoreInitRow(row, block, p, len, ROW_MAPPED);
+        if (known) in_comment = editorHighlightState(p, len, in_comment);
+        row->hl_open_comment = in_comment;
+        p = next;
+    }
+}
+
+// this gives us the erow at index at. rows move around inside their block when a row is inserted or deleted, so the pointer is only good until the next one of those
+erow *editorRowAt(int at) {
+    int off;
+    int b = rowStoreFind(at, &off);
+    rowBlockLoad(E.blocks[b]);
+    return &E.blocks[b]->rows[off];
+}
+
+// this works out a row's index in the file from the position of its block and its position inside the block
+int editorRowIndex(erow *row) {
+    return rowStoreTreePrefix(row->block->index) + (int) (row - row->block->rows);
+}
+
+// this puts block into E.blocks at position b
+void rowStoreAddBlock(int b, struct rowBlock *block) {
+    if (E.nblocks == E.blockcap) {
+        E.blockcap = E.blockcap ? E.blockcap * 2 : 4;
+        E.blocks = krealloc(E.blocks, sizeof(struct rowBlock *) * E.blockcap);
+        E.blocktree = krealloc(E.blocktree, sizeof(int) * (E.blockcap + 1));
+    }
+    memmove(&E.blocks[b + 1], &E.blocks[b], sizeof(struct rowBlock *) * (E.nblocks - b));
+    E.blocks[b] = block;
+    E.nblocks++;
+    block->index = b;
+
+    if (b == E.nblocks - 1) {
+        // a block added at the end doesn't move any other block, so instead of rebuilding the tree we can fill in its new node directly. node n covers the blocks after n - (n & -n), so it's the new block's rows plus the nodes of the groups just before it. loading a file adds blocks this way, one after another
+        int n = E.nblocks;
+        E.blocktree[n] = block->nrows;
+        for (int j = n - 1; j > n - (n & -n); j -= j & -j) E.blocktree[n] += E.blocktree[j];
+        return;
+    }
+    // the blocks after the new one have all moved up by one position
+    for (int j = b; j < E.nblocks; j++) E.blocks[j]->index = j;
+    rowStoreRebuildTree();
+}
+
+// this makes room for a new row at index at and returns a pointer to it, leaving it up to the caller to fill it in
+erow *rowStoreInsert(int at) {
+    struct rowBlock *block;
+    int off;
+
+    if (E.nblocks == 0) {
+        block = kcalloc(1, sizeof(struct rowBlock));
+        rowStoreAddBlock(0, block);
+    }
+
+    int b = rowStoreFind(at, &off);
+    block = E.blocks[b];
+    rowBlockLoad(block);
+    if (block->nrows == KILO_BLOCK_ROWS) {
+        // the block is full, so we split it into two half-full blocks by moving its second half into a new block right after it
+        struct rowBlock *next = kcalloc(1, sizeof(struct rowBlock));
+        int half = block->nrows / 2;
+        next->nrows = block->nrows - half;
+        next->cap = KILO_BLOCK_ROWS;
+        next->rows = kmalloc(sizeof(erow) * next->cap);
+        memcpy(next->rows, &block->rows[half], sizeof(erow) * next->nrows);
+        for (int j = 0; j < next->nrows; j++) next->rows[j].block = next;
+        block->nrows = half;
+        // the tree has to know the block shrank before the new block goes in, since adding a block at the end builds its node out of the nodes before it
+        rowStoreTreeAdd(b, -next->nrows);
+        rowStoreAddBlock(b + 1, next);
+        if (off > half) {
+            block = next;
+            off -= half;
+        }
+    }
+
+    if (block->nrows == block->cap) {
+        // blocks start out small and double in size up to KILO_BLOCK_ROWS, so that short files don't use up a whole block's worth of memory
+        block->cap = block->cap ? block->cap * 2 : 8;
+        if (block->cap > KILO_BLOCK_ROWS) block->cap = KILO_BLOCK_ROWS;
+        block->rows = krealloc(block->rows, sizeof(erow) * block->cap);
+    }
+    memmove(&block->rows[off + 1], &block->rows[off], sizeof(erow) * (block->nrows - off));
+    block->nrows++;
+    rowStoreTreeAdd(block->index, 1);
+
+    block->rows[off].block = block;
+    return &block->rows[off];
+}
+
+// this adds the lines of text[0..len) to the end of the row store, as rows whose chars point into text, and returns how many it added. text has to stay where it is for as long as the rows do, and flags says where that is. the rows fill up the last block and then go into new blocks, so a burst of lines takes a few allocations rather than one for every line. like the rows of rowBlockLoad(), they're only rendered when they're first drawn
+int rowStoreAppendText(char *text, size_t len, int flags) {
+    char *p = text, *end = text + len;
+    int added = 0;
+    while (p < end) {
+        struct rowBlock *block = E.nblocks ? E.blocks[E.nblocks - 1] : NULL;
+        if (block) rowBlockLoad(block);
+        if (!block || block->nrows == KILO_BLOCK_ROWS) {
+            block = kcalloc(1, sizeof(struct rowBlock));
+            rowStoreAddBlock(E.nblocks, block);
+        }
+        int first = block->nrows;
+        while (p < end && block->nrows < KILO_BLOCK_ROWS) {
+            if (block->nrows == block->cap) {
+                block->cap = block->cap ? block->cap * 2 : 8;
+                if (block->cap > KILO_BLOCK_ROWS) block->cap = KILO_BLOCK_ROWS;
+                block->rows = krealloc(block->rows, sizeof(erow) * block->cap);
+            }
+            int n;
+            char *next = editorMapLine(p, end, &n);
+            rowStoreInitRow(&block->rows[block->nrows++], block, p, n, flags);
+            p = next;
+        }
+        // the tree only hears about each block's new rows once, however many of them there are
+        rowStoreTreeAdd(block->index, block->nrows - first);
+        added += block->nrows - first;
+    }
+    return added;
+}
+
+// this removes the row at index at from the row store. freeing the row's memory is left up to the caller
+void rowStoreDelete(int at) {
+    int off;
+    int b = rowStoreFind(at, &off);
+    struct rowBlock *block = E.blocks[b];
+    rowBlockLoad(block);
+    memmove(&block->rows[off], &block->rows[off + 1], sizeof(erow) * (block->nrows - off - 1));
+    block->nrows--;
+    rowStoreTreeAdd(b, -1);
+
+    // when a block runs out of rows we drop it, so that the tree doesn't fill up with empty blocks
+    if (block->nrows == 0) {
+        free(block->rows);
+        free(block);
+        memmove(&E.blocks[b], &E.blocks[b + 1], sizeof(struct rowBlock *) * (E.nblocks - b - 1));
+        E.nblocks--;
+        for (int j = b; j < E.nblocks; j++) E.blocks[j]->index = j;
+        rowStoreRebuildTree();
+    }
+}
+
+// this takes count rows out of the row store starting at at, freeing each of them. the blocks that end up empty are dropped all together at the end, so the tree only has to be rebuilt once however many rows went
+void rowStoreDeleteRange(int at, int count) {
+    int off;
+    int first = rowStoreFind(at, &off);
+    for (int b = first; count > 0; b++) {
+        struct rowBlock *block = E.blocks[b];
+        int n = block->nrows - off;
+        if (n > count) n = count;
+        // a block that goes away completely without ever having been loaded has no erows to free
+        if (n < block->nrows || block->rows) {
+            rowBlockLoad(block);
+            for (int j = off; j < off + n; j++) editorFreeRow(&block->rows[j]);
+            memmove(&block->rows[off], &block->rows[off + n], sizeof(erow) * (block->nrows - off - n));
+        }
+        block->nrows -= n;
+        count -= n;
+        off = 0;
+    }
+
+    int to = first;
+    for (int b = first; b < E.nblocks; b++) {
+        struct rowBlock *block = E.blocks[b];
+        if (block->nrows == 0) {
+            free(block->rows);
+            free(block);
+            continue;
+        }
+        block->index = to;
+        E.blocks[to++] = block;
+    }
+    E.nblocks = to;
+    rowStoreRebuildTree();
+}
+
+/*** syntax highlighting ***/
+
+void editorUpdateRow(erow *row);
+void editorRowRender(erow *row);
+void editorHlInvalidate(int from, int until);
+
+int is_separator(int c) {
+    // strchr() looks for the first occurrence of a character in a string, then returns a pointer to the matching character in the string. if the string doesn't contain the character, it returns NULL
+    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[]", c) != NULL;
+}
+
+// this returns whether the len characters of text starting at i begin with the string s of length slen. unlike calling strncmp() on the text, it never looks past the end of the text, so it works on text that isn't null-terminated, like a line in a memory-mapped file
+int editorMatchAt(const char *text, int len, int i, const char *s, int slen) {
+    return i + slen <= len && !memcmp(&text[i], s, slen);
+}
+
+// this sorts keywords by first character, then by length. keywords that are the same in both stay in the order they were listed in, so that the first of two identical keywords still wins like it did when we went through the list in order
+int editorKeywordCompare(const void *a, const void *b) {
+    const struct editorKeyword *x = a, *y = b;
+    unsigned char cx = x->word[0], cy = y->word[0];
+    if (cx != cy) return cx - cy;
+    if (x->len != y->len) return x->len - y->len;
+    return x->order - y->order;
+}
+
+// this builds the lookup table for a NULL-terminated keywords list. we work out each keyword's length and whether it's a secondary keyword once here, instead of every time we check a word
+void editorBuildKeywords(struct editorKeywordTable *t, char **keywords) {
+    int n = 0;
+    while (keywords[n]) n++;
+    t->words = kmalloc(sizeof(struct editorKeyword) * (n ? n : 1));
+    t->other = kmalloc(sizeof(struct editorKeyword) * (n ? n : 1));
+    int nwords = 0;
+    t->nother = 0;
+    memset(t->lengths, 0, sizeof(t->lengths));
+
+    for (int j = 0; j < n; j++) {
+        struct editorKeyword kw;
+        kw.word = keywords[j];
+        kw.len = strlen(keywords[j]);
+        kw.type = HL_KEYWORD1;
+        kw.order = j;
+        // a | at the end marks a secondary keyword, and isn't part of the keyword itself
+        if (kw.len && keywords[j][kw.len - 1] == '|') {
+            kw.len--;
+            kw.type = HL_KEYWORD2;
+        }
+        if (kw.len == 0) continue;
+
+        int has_sep = 0;
+        for (int k = 0; k < kw.len; k++) {
+            if (is_separator((unsigned char) kw.word[k])) has_sep = 1;
+        }
+        if (has_sep) t->other[t->nother++] = kw;
+        else t->words[nwords++] = kw;
+    }
+
+    // qsort() doesn't keep equal elements in order, so the comparison falls back on each keyword's position in the list
+    qsort(t->words, nwords, sizeof(struct editorKeyword), editorKeywordCompare);
+
+    int c = 0;
+    for (int j = 0; j < nwords; j++) {
+        unsigned char first = t->words[j].word[0];
+        while (c <= first) t->start[c++] = j;
+        t->lengths[first] |= 1u << (t->words[j].len < 31 ? t->words[j].len : 31);
+    }
+    while (c <= 256) t->start[c++] = nwords;
+}
+
+// this checks whether a keyword starts at position i of text, and if so stores its length in klen and returns HL_KEYWORD1 or HL_KEYWORD2. otherwise it returns 0. a keyword needs a separator (or the end of the line) right after it, so the only keyword that can match is one exactly as long as the word that starts at i
+int editorKeywordAt(const struct editorHighlighter *h, const char *text, int len, int i, int *klen) {
+    const struct editorKeywordTable *t = &h->keywords;
+
+    // the few keywords with separators in them get checked the old way, one at a time, in the order they were listed in
+    for (int j = 0; j < t->nother; j++) {
+        struct editorKeyword *kw = &t->other[j];
+        if (editorMatchAt(text, len, i, kw->word, kw->len) && (i + kw->len == len || h->sep[(unsigned char) text[i + kw->len]])) {
+            *klen = kw->len;
+            return kw->type;
+        }
+    }
+
+    unsigned char first = text[i];
+    if (!t->lengths[first]) return 0;
+    int wlen = 1;
+    while (i + wlen < len && !h->sep[(unsigned char) text[i + wlen]]) wlen++;
+    if (!(t->lengths[first] & (1u << (wlen < 31 ? wlen : 31)))) return 0;
+
+    for (int j = t->start[first]; j < t->start[first + 1]; j++) {
+        struct editorKeyword *kw = &t->words[j];
+        if (kw->len > wlen) break;
+        if (kw->len == wlen && !memcmp(&text[i], kw->word, wlen)) {
+            *klen = wlen;
+            return kw->type;
+        }
+    }
+    return 0;
+}
+
+// this compiles a filetype into the tables the highlighter runs on. everything the old highlighter worked out with if-statements for each character, like whether the filetype highlights numbers, or whether the character before was a separator, is worked out here once, for every state and every class of byte
+void editorCompileSyntax(struct editorHighlighter *h, struct editorSyntax *syntax) {
+    h->scs = syntax->singleline_comment_start;
+    h->mcs = syntax->multiline_comment_start;
+    h->mce = syntax->multiline_comment_end;
+    h->scs_len = h->scs ? strlen(h->scs) : 0;
+    h->mcs_len = h->mcs ? strlen(h->mcs) : 0;
+    h->mce_len = h->mce ? strlen(h->mce) : 0;
+    // multi-line comments need both a start and an end to be highlighted
+    if (!h->mcs_len || !h->mce_len) h->mcs_len = h->mce_len = 0;
+
+    int numbers = syntax->flags & HL_HIGHLIGHT_NUMBERS;
+    int strings = syntax->flags & HL_HIGHLIGHT_STRINGS;
+
+    for (int c = 0; c < 256; c++) {
+        int cls = HLC_WORD;
+        if (c >= '0' && c <= '9') cls = HLC_DIGIT;
+        else if (c == '.') cls = HLC_DOT;
+        else if (c == '"') cls = HLC_DQUOTE;
+        else if (c == '\'') cls = HLC_SQUOTE;
+        else if (c == '\\') cls = HLC_BACKSLASH;
+        else if (is_separator(c)) cls = HLC_SEP;
+        h->base[c] = cls;
+        h->cls[c] = cls;
+        h->sep[c] = is_separator(c) ? 1 : 0;
+    }
+    if (h->scs_len) h->cls[(unsigned char) h->scs[0]] = HLC_DELIM;
+    if (h->mcs_len) {
+        h->cls[(unsigned char) h->mcs[0]] = HLC_DELIM;
+        h->cls[(unsigned char) h->mce[0]] = HLC_DELIM;
+    }
+
+    for (int st = 0; st < HLS_COUNT; st++) {
+        for (int cls = 0; cls < HLC_COUNT; cls++) {
+            struct editorHlTransition *t = &h->trans[st][cls];
+            t->action = 0;
+            if (st == HLS_COMMENT) {
+                // everything in a multi-line comment is part of the comment, until editorHighlight() finds the delimiter that ends it
+                t->hl = HL_MLCOMMENT;
+                t->next = HLS_COMMENT;
+            } else if (st == HLS_DQUOTE || st == HLS_SQUOTE) {
+                // the quote that started the string ends it. we consider the closing quote to be a separator
+                t->hl = HL_STRING;
+                t->next = st;
+                if ((st == HLS_DQUOTE && cls == HLC_DQUOTE) || (st == HLS_SQUOTE && cls == HLC_SQUOTE)) t->next = HLS_SEP;
+                // here we account for escape quotes, because in most programming languages, \' and \" don't close strings
+                if (cls == HLC_BACKSLASH) t->action = HLA_ESCAPE;
+            } else if (strings && (cls == HLC_DQUOTE || cls == HLC_SQUOTE)) {
+                t->hl = HL_STRING;
+                t->next = cls == HLC_DQUOTE ? HLS_DQUOTE : HLS_SQUOTE;
+            } else if (numbers && ((cls == HLC_DIGIT && (st == HLS_SEP || st == HLS_NUMBER)) || (cls == HLC_DOT && st == HLS_NUMBER))) {
+                // to highlight a digit with HL_NUMBER we require the previous character to be a separator, or to also be highlighted with HL_NUMBER. we're also accounting for decimals here by highlighting a '.' that comes after a character we just highlighted as a number
+                t->hl = HL_NUMBER;
+                t->next = HLS_NUMBER;
+            } else {
+                t->hl = HL_NORMAL;
+                t->next = (cls == HLC_SEP || cls == HLC_DOT) ? HLS_SEP : HLS_WORD;
+                // keywords require a separator before and after the word to avoid highlighting the middle of certain words etc, so we only look for one right after a separator
+                if (st == HLS_SEP) t->action = HLA_KEYWORD;
+            }
+        }
+    }
+
+    editorBuildKeywords(&h->keywords, syntax->keywords);
+    h->built = 1;
+}
+
+// this puts a checkpoint in marks every KILO_ROW_MARK bytes of text from from on, all in the same state. it's for the part of a line the highlighter doesn't have to go through, because it's all one single-line comment, or because there's no filetype
+void editorHlFillMarks(const char *text, int len, int from, int state, struct rowMark *marks, int *nmarks) {
+    for (int p = from; p < len; p = (p / KILO_ROW_MARK + 1) * KILO_ROW_MARK) {
+        while (p > 0 && p < len && UTF8_CONT(text[p])) p++;
+        if (p >= len) break;
+        marks[*nmarks].cx = p;
+        marks[*nmarks].state = state;
+        (*nmarks)++;
+    }
+}
+
+// this is the syntax highlighter itself. it fills in hl for the len characters of text, starting out in state, and returns the state the line ends in
+// // it only reads E.syntax and the text it's given, so the background highlighter can run it on lines that aren't rendered, or even loaded as rows, as well as on a row's render
+// // each byte is looked up in the tables editorCompileSyntax() built, which tell us its highlight and the next state. the only bytes that need more than that are ones that might start a comment delimiter, a backslash in a string, and the start of a word that could be a keyword, and each of those is flagged in the tables
+// // if marks is set, it also leaves a checkpoint there every KILO_ROW_MARK bytes, at the first byte that starts a character from there on, and sets *nmarks to how many it left. marks needs room for len / KILO_ROW_MARK + 2 of them
+int editorHighlightRun(const char *text, int len, unsigned char *hl, int state, struct rowMark *marks, int *nmarks) {
+    if (marks) *nmarks = 0;
+    // if no filetype is set, the entire line is HL_NORMAL. a line that starts in a single-line comment is a comment all the way through
+    if (E.syntax == NULL || state == HLS_LINE) {
+        memset(hl, E.syntax ? HL_COMMENT : HL_NORMAL, len);
+        if (marks) editorHlFillMarks(text, len, 0, state, marks, nmarks);
+        return state;
+    }
+    const struct editorHighlighter *h = E.highlighter;
+
+    int i = 0;
+    int mark = marks ? 0 : INT_MAX; // where the next checkpoint is due
+    while (i < len) {
+        if (i >= mark && (i == 0 || !UTF8_CONT(text[i]))) {
+            marks[*nmarks].cx = i;
+            marks[*nmarks].state = state;
+            (*nmarks)++;
+            mark = (i / KILO_ROW_MARK + 1) * KILO_ROW_MARK;
+        }
+        unsigned char c = text[i];
+        int cls = h->cls[c];
+
+        if (cls == HLC_DELIM) {
+            // comment delimiters don't count inside a string
+            if (state == HLS_COMMENT) {
+                // if we are at the end of a multi-line comment then we highlight the whole mce string with HL_MLCOMMENT and "consume" it. we consider the */ that marks the end of a multi-line comment to be a separator
+                if (editorMatchAt(text, len, i, h->mce, h->mce_len)) {
+                    memset(&hl[i], HL_MLCOMMENT, h->mce_len);
+                    i += h->mce_len;
+                    state = HLS_SEP;
+                    continue;
+                }
+            } else if (state != HLS_DQUOTE && state != HLS_SQUOTE) {
+                // if the character is the start of a single-line comment, then we memset() the rest of the line with HL_COMMENT, and the line is done being highlighted
+                if (h->scs_len && editorMatchAt(text, len, i, h->scs, h->scs_len)) {
+                    memset(&hl[i], HL_COMMENT, len - i);
+                    state = HLS_LINE;
+                    if (marks) editorHlFillMarks(text, len, mark, state, marks, nmarks);
+                    break;
+                }
+                // if we're at the beginning of a multi-line comment then we highlight and "consume" the whole mcs string
+                if (h->mcs_len && editorMatchAt(text, len, i, h->mcs, h->mcs_len)) {
+                    memset(&hl[i], HL_MLCOMMENT, h->mcs_len);
+                    i += h->mcs_len;
+                    state = HLS_COMMENT;
+                    continue;
+                }
+            }
+            // it wasn't a delimiter after all, so the byte is handled like any other byte of its class
+            cls = h->base[c];
+        }
+
+        const struct editorHlTransition *t = &h->trans[state][cls];
+        if (t->action) {
+            if (t->action == HLA_KEYWORD) {
+                int klen;
+                int type = editorKeywordAt(h, text, len, i, &klen);
+                if (type) {
+                    // we highlight the whole keyword at once and then consume it
+                    memset(&hl[i], type, klen);
+                    i += klen;
+                    state = HLS_WORD;
+                    continue;
+                }
+            } else if (i + 1 < len) {
+                // HLA_ESCAPE: the backslash and the character after it are both part of the string
+                hl[i] = hl[i + 1] = HL_STRING;
+                i += 2;
+                continue;
+            }
+        }
+        hl[i] = t->hl;
+        state = t->next;
+        i++;
+    }
+    return state;
+}
+
+// this highlights a whole line, starting out inside a multi-line comment if in_comment is set, and returns whether the line ends inside a multi-line comment
+int editorHighlight(const char *text, int len, unsigned char *hl, int in_comment) {
+    return editorHighlightRun(text, len, hl, in_comment ? HLS_COMMENT : HLS_SEP, NULL, NULL) == HLS_COMMENT;
+}
+
+// this tells us whether the row just before row ends inside a multi-line comment, which is the state row starts out highlighting in. the previous row is either the one just before it in its block, or the last row of the previous block, which might not even be loaded, in which case the block remembers the state it ends in
+int editorRowStartState(erow *row) {
+    struct rowBlock *block = row->block;
+    if (row > block->rows) return row[-1].hl_open_comment;
+    if (block->index == 0) return 0;
+    return rowBlockEndState(E.blocks[block->index - 1]);
+}
+
+// this gives us the row after row, but only if it's already loaded, which is all the highlighter needs when it's marking it as needing to be rehighlighted
+erow *editorRowNextLoaded(erow *row) {
+    struct rowBlock *block = row->block;
+    if (row + 1 < block->rows + block->nrows) return row + 1;
+    if (block->index + 1 >= E.nblocks) return NULL;
+    return E.blocks[block->index + 1]->rows;
+}
+
+// this highlights a row's render, starting out in the state the previous row ended in
+// // it doesn't touch any of the rows after it anymore. if the row now ends in a different state than before, the next row is marked as needing to be rehighlighted, and the background highlighter is told to carry the change through the rest of the file. rows on the screen get rehighlighted by editorHighlightWindow() before they're drawn, so a change never makes us rehighlight rows that can't be seen
+void editorUpdateSyntax(erow *row) {
+    // the background highlighter comes through here too, but its time isn't part of any frame
+    int timed = E.stats && !pthread_equal(pthread_self(), E.hlthread);
+    long long start = timed ? editorMicros() : 0;
+    // a long row is highlighted from its start without keeping the highlighting, just the checkpoints along it, and then only its window is highlighted for real
+    int in_comment;
+    if (row->flags & ROW_WINDOWED) in_comment = editorRowMarkSyntax(row, editorRowStartState(row));
+    else in_comment = editorHighlight(row->render, row->rsize, row->hl, editorRowStartState(row));
+    if (timed) E.frame.syntax += editorMicros() - start;
+    row->flags &= ~ROW_HL_STALE;
+    // here we check if the value of this line's hl_open_comment variable changed
+    if (row->hl_open_comment != in_comment) {
+        // here we set the current row's hl_open_comment value to whatever in_comment was left in after the entire row was processed
+        row->hl_open_comment = in_comment;
+        erow *next = editorRowNextLoaded(row);
+        if (next) next->flags |= ROW_HL_STALE;
+        int idx = editorRowIndex(row);
+        editorHlInvalidate(idx + 1, idx + 2);
+    }
+}
+
+int editorSyntaxToColor(int hl) {
+    switch (hl) {
+        // we're handling HL_NORMAL separately so we don't include it here
+        case HL_COMMENT:
+        case HL_MLCOMMENT: return 36; // both single and multi-line comments will be rendered in cyan
+        case HL_KEYWORD1: return 33; // keywords defined here will render yellow
+        case HL_KEYWORD2: return 31; // keywords defined here will render red
+        case HL_STRING: return 35; // any string enclosed by quotes will be rendered magenta
+        case HL_NUMBER: return 32; // any number will be rendered green
+        case HL_MATCH: return 34; // any match to a search query will be rendered blue
+        default: return 37; // anything else will be rendered white
+    }
+}
+
+// this function will try to match the current filename to one of the filematch fields in HLDB. if one matches, it'll set E.syntax to that filetype
+void editorSelectSyntaxHighlight(void) {
+    // we set E.syntax to NULL first so that if there is no filename, then there is no filetype
+    E.syntax = NULL;
+    if (E.filename == NULL) return;
+
+    // strrchr() returns a pointer to the last occurrence of a character in a string
+    // if there is no extension, then ext will be NULL
+    char *ext = strrchr(E.filename, '.');
+
+    // we loop through each editorSyntax struct in the HLDB array, and for each of those we loop through each pattern in its filematch array
+    for (unsigned int j = 0; j < HLDB_ENTRIES; j++) {
+        struct editorSyntax *s = &HLDB[j];
+        unsigned int i = 0;
+        while (s->filematch[i]) {
+            int is_ext = (s->filematch[i][0] == '.');
+            // strcmp() returns 0 if two given strings are equal
+            // if the pattern stats with a . then it's a file extension pattern and we use strmp() to see if the filename ends with that extension. if it's not a file extension pattern then we just check to see if the pattern exists anywhere in the filename, using strstr(). 
+            if ((is_ext && ext && !strcmp(ext, s->filematch[i])) || (!is_ext && strstr(E.filename, s->filematch[i]))) {
+                // if the filename matched according to those rules, then we set E.syntax to the current editorSyntax struct, and return
+                E.syntax = s;
+                // the first time a filetype is picked, we compile it into the tables the highlighter runs on
+                E.highlighter = &HLDB_compiled[j];
+                if (!E.highlighter->built) editorCompileSyntax(E.highlighter, s);
+                
+                // in order to update the highlighting for the entire file after setting E.syntax, we mark every row that's been highlighted as needing to be highlighted again, and have the background highlighter go through the whole file. the rows on the screen get rehighlighted before the next time they're drawn, so the highlighting changes immediately when the filetype changes
+                for (int b = 0; b < E.nblocks; b++) {
+                    struct rowBlock *block = E.blocks[b];
+                    if (!block->rows) continue;
+                    for (int r = 0; r < block->nrows; r++) block->rows[r].flags |= ROW_HL_STALE;
+                }
+                editorHlInvalidate(0, E.numrows);
+
+                return;
+            }
+            i++;
+        }
+    }
+}
+
+/*** background highlighting ***/
+
+// the background highlighter only needs to know the state each line ends in, not its hl, so it highlights into a scratch buffer that it reuses for every line
+unsigned char *hl_scratch = NULL;
+int hl_scratch_cap = 0;
+char *hl_text_scratch = NULL;
+int hl_text_scratch_cap = 0;
+
+// this gives us a scratch buffer to highlight a line of len bytes into
+unsigned char *editorHlScratch(int len) {
+    if (len > hl_scratch_cap) {
+        hl_scratch_cap = len * 2;
+        hl_scratch = krealloc(hl_scratch, hl_scratch_cap);
+    }
+    return hl_scratch;
+}
+
+// this returns whether a line ends inside a multi-line comment, without keeping its highlighting
+int editorHighlightState(const char *text, int len, int in_comment) {
+    return editorHighlight(text, len, editorHlScratch(len), in_comment);
+}
+
+// this tells the background highlighter that the rows from from on might end in a different state than they did before, and that it has to check at least up to until before it can stop
+void editorHlInvalidate(int from, int until) {
+    if (from >= E.numrows) return;
+    if (from < E.hl_frontier) E.hl_frontier = from;
+    if (until > E.hl_until) E.hl_until = until;
+    pthread_cond_signal(&E.hlcond);
+}
+
+// when a row is inserted or deleted at at, the rows the background highlighter still has to look at move along with it
+void editorHlShift(int at, int delta) {
+    if (E.hl_frontier != INT_MAX && E.hl_frontier > at) E.hl_frontier += delta;
+    if (E.hl_until > at) E.hl_until += delta;
+}
+
+// this gives us a row's chars all in one piece, for the highlighter to go through
+const char *editorRowText(erow *row) {
+    const char *text = row->chars;
+    if (row->gap < row->size && row->gaplen) {
+        // the gap is in the middle of the row, so we piece the text together in a scratch buffer instead of moving the gap, which would change the row out from under whoever is editing it
+        if (row->size > hl_text_scratch_cap) {
+            hl_text_scratch_cap = row->size * 2;
+            hl_text_scratch = krealloc(hl_text_scratch, hl_text_scratch_cap);
+        }
+        memcpy(hl_text_scratch, row->chars, row->gap);
+        memcpy(hl_text_scratch + row->gap, &row->chars[row->gap + row->gaplen], row->size - row->gap);
+        text = hl_text_scratch;
+    }
+    return text;
+}
+
+// this checks the state a loaded row ends in, starting from in_comment, and returns it. the tabs in chars haven't been expanded like they are in render, but tabs and spaces are both separators as far as the highlighter is concerned, so the state comes out the same
+int editorHlCheckRow(erow *row, int in_comment) {
+    return editorHighlightState(editorRowText(row), row->size, in_comment);
+}
+
+// this runs through one batch of rows starting at E.hl_frontier, working out the state each one ends in from the state the one before it ended in
+// // as soon as a row ends in the same state it did before, and we're past E.hl_until, every row after it will also be the same, so we can stop. rows we go past get marked as needing to be rehighlighted, and if any of them are on the screen we ask for a redraw
+void editorHlStep(void) {
+    int off;
+    int b = rowStoreFind(E.hl_frontier, &off);
+    int at = E.hl_frontier;
+    int count = 0;
+
+    while (b < E.nblocks && count < KILO_HL_BATCH) {
+        struct rowBlock *block = E.blocks[b];
+        int in_comment = b > 0 ? rowBlockEndState(E.blocks[b - 1]) : 0;
+        int changed;
+
+        if (!block->rows) {
+            // a block that hasn't been loaded is gone through straight out of the memory-mapped file, and only the state of its last line is kept
+            char *p = &E.map[block->mapoff];
+            char *end = p + block->maplen;
+            for (int j = 0; j < block->nrows; j++) {
+                int len;
+                char *next = editorMapLine(p, end, &len);
+                in_comment = editorHighlightState(p, len, in_comment);
+                p = next;
+            }
+            changed = !block->hl_scanned || block->hl_out != in_comment;
+            block->hl_out = in_comment;
+            block->hl_scanned = 1;
+            at += block->nrows - off;
+            count += block->nrows;
+        } else {
+            if (off > 0) in_comment = block->rows[off - 1].hl_open_comment;
+            changed = 0;
+            for (; off < block->nrows; off++, at++, count++) {
+                erow *row = &block->rows[off];
+                in_comment = editorHlCheckRow(row, in_comment);
+                changed = row->hl_open_comment != in_comment;
+                row->hl_open_comment = in_comment;
+                if (row->render) {
+                    row->flags |= ROW_HL_STALE;
+                    if (editorRowOnScreen(at)) E.redraw = 1;
+                }
+                // the row after this one starts in the state this one ends in, so if it's on the screen it has to be redrawn too
+                if (changed && editorRowOnScreen(at + 1)) E.redraw = 1;
+                if (!changed && at + 1 >= E.hl_until) {
+                    at++;
+                    break;
+                }
+            }
+            block->hl_scanned = 1;
+        }
+
+        if (!changed && at >= E.hl_until) {
+            E.hl_frontier = INT_MAX;
+            E.hl_until = 0;
+            return;
+        }
+        b++;
+        off = 0;
+    }
+
+    E.hl_frontier = at;
+    if (E.hl_frontier >= E.numrows) {
+        E.hl_frontier = INT_MAX;
+        E.hl_until = 0;
+    }
+}
+
+// this finds a buffer the background highlighter has work to do in, and returns its index, or -1 if there isn't one. the current buffer comes first, since it's the one being looked at
+int editorHlPending(void) {
+    if (E.hl_frontier < E.numrows) return E.curbuf;
+    for (int b = 0; b < E.nbuffers; b++) {
+        if (b != E.curbuf && E.buffers[b].hl_frontier < E.buffers[b].numrows) return b;
+    }
+    return -1;
+}
+
+// this is the background highlighter's thread. it waits until there's work to do, then does it a batch at a time, letting go of E.lock after each batch so that it never holds up the main thread for long
+// // every buffer gets highlighted, not just the current one, so a buffer that's switched to is ready to be drawn. the highlighter makes a buffer with work to do the current one for the length of a batch, and the main thread never sees it, since it doesn't look at E without E.lock
+void *editorHlThread(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&E.lock);
+    while (1) {
+        int b;
+        while ((b = editorHlPending()) == -1) pthread_cond_wait(&E.hlcond, &E.lock);
+        int redraw = E.redraw;
+        int cur = E.curbuf;
+        editorBufferSwitch(b);
+        editorHlStep();
+        editorBufferSwitch(cur);
+        // if we changed something on the screen, the main thread has to wake up and draw it
+        if (E.redraw && !redraw) editorWake();
+        pthread_mutex_unlock(&E.lock);
+        sched_yield();
+        pthread_mutex_lock(&E.lock);
+    }
+    return NULL;
+}
+
+// this makes sure the state row at starts highlighting in is right before we jump to it, which a jump far into a big file needs
+// // the background highlighter goes through the file from E.hl_frontier on, and every block it has been through knows the state its last line ends in. those blocks are the checkpoints, one at most every KILO_BLOCK_ROWS rows: a row before the frontier only takes going through the rows before it in its own block, which rowBlockLoad() does when the block is loaded, so there's nothing for us to do
+// // a row past the frontier starts from the checkpoint just above its block, or from the frontier if that's inside the block, and we go through the rest of the block from there, so a jump never costs more than one block of rows however far the frontier is behind. a block the highlighter hasn't been through yet gives us no checkpoint, so we guess the row above isn't in a comment. either way the frontier is left where it is, and if the state we started from was wrong the background highlighter fixes the rows when it gets there
+void editorHlSettle(int at) {
+    if (E.syntax == NULL || at < E.hl_frontier || E.hl_frontier >= E.numrows) return;
+    int off;
+    int b = rowStoreFind(at, &off);
+    struct rowBlock *block = E.blocks[b];
+    rowBlockLoad(block);
+
+    int from = 0;
+    int in_comment = 0;
+    if (E.hl_frontier > at - off) {
+        from = E.hl_frontier - (at - off);
+        in_comment = block->rows[from - 1].hl_open_comment;
+    } else if (b > 0 && E.blocks[b - 1]->hl_scanned) {
+        in_comment = rowBlockEndState(E.blocks[b - 1]);
+    }
+    for (int j = from; j < block->nrows; j++) {
+        erow *row = &block->rows[j];
+        in_comment = editorHlCheckRow(row, in_comment);
+        row->hl_open_comment = in_comment;
+        if (row->render) row->flags |= ROW_HL_STALE;
+    }
+}
+
+// this rehighlights any rows on the screen that need it, in order from the top of the screen down, so that a change in one row carries through to the rows below it before anything gets drawn. rows off the screen are left to the background highlighter
+void editorHighlightWindow(void) {
+    for (int y = 0; y < E.screenrows; y++) {
+        int filerow = y + E.rowoff;
+        if (filerow >= E.numrows) break;
+        editorRowRender(editorRowAt(filerow));
+    }
+}
+
+/*** row operations ***/
+
+// this gives us how many of a row's tabs come before chars index cx, with a binary search of its table of tabs
+int editorRowTabsBefore(erow *row, int cx) {
+    int lo = 0, hi = row->ntabs;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (row->tabs[mid].cx < cx) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// this converts a chars index into a render index, going by the row's table of tabs as it is, without rendering the row first
+// // every character other than a tab is copied into render as it is, so cx is as many bytes past the end of the last tab's spaces as it is past the tab
+int editorRowTabRx(erow *row, int cx) {
+    int n = editorRowTabsBefore(row, cx);
+    if (n == 0) return cx;
+    struct tabStop *t = &row->tabs[n - 1];
+    return t->end + (cx - t->cx - 1);
+}
+
+// this function converts a chars index into a render index.
+int editorRowCxToRx(erow *row, int cx) {
+    editorRowRender(row);
+    return editorRowTabRx(row, cx);
+}
+
+// to convert an rx to a cx we reverse the function for doing the opposite. we find the last tab whose spaces start at or before rx. if rx is in the middle of them, the tab is the character it belongs to. otherwise it's as many characters past the tab as rx is past its spaces
+int editorRowRxToCx(erow *row, int rx) {
+    editorRowRender(row);
+    int lo = 0, hi = row->ntabs;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (row->tabs[mid].rx <= rx) lo = mid + 1;
+        else hi = mid;
+    }
+    int cx = rx;
+    if (lo > 0) {
+        struct tabStop *t = &row->tabs[lo - 1];
+        cx = rx < t->end ? t->cx : t->cx + 1 + (rx - t->end);
+    }
+    // this is just in case the caller provides an rx that's out of range, which shouldn't happen
+    return cx < row->size ? cx : row->size;
+}
+
+// this gives us how many of a long row's checkpoints have the field at offset field, which is one of the ints of a rowMark, no bigger than v. they're in order, so we can use a binary search
+int editorRowMarksUpTo(erow *row, size_t field, int v) {
+    int lo = 0, hi = row->nmarks;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (*(int *) ((char *) &row->marks[mid] + field) <= v) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// this expands the chars of a row from from up to to the way they go into render, starting at column *col of the screen, and returns how many bytes of render they take up. *col is left at the column after them
+// // out can be NULL, to work out where everything ends up without writing it anywhere. if tabs is set, each tab goes into the row's table of tabs, with rx being the index into render that from ends up at
+int editorRowExpand(erow *row, int from, int to, int *col, char *out, int tabs, int rx) {
+    int ascii = !(row->flags & ROW_UTF8);
+    int idx = 0;
+    // c0 is the column of the screen we're at, which a tab's spaces go up to the next tab stop from. in a row that's all ASCII it goes along with idx
+    int c0 = *col;
+    for (int j = from; j < to; j++) {
+        char c = ROW_CHAR(row, j);
+        if (c == '\t') {
+            if (tabs) {
+                row->tabs[row->ntabs].cx = j;
+                row->tabs[row->ntabs].rx = rx + idx;
+            }
+            do {
+                if (out) out[idx] = ' ';
+                idx++;
+                c0++;
+            } while (c0 % KILO_TAB_STOP != 0);
+            if (tabs) row->tabs[row->ntabs++].end = rx + idx;
+        } else if (ascii || (unsigned char) c < 0x80) {
+            if (out) out[idx] = c;
+            idx++;
+            c0++;
+        } else {
+            // the bytes of a character that isn't ASCII are copied over all together, and it moves col along by however many columns it takes up
+            char seq[4];
+            int n = 0;
+            while (n < 4 && j + n < row->size) {
+                seq[n] = ROW_CHAR(row, j + n);
+                n++;
+            }
+            int cp, w;
+            n = editorGlyph(seq, n, &cp, &w);
+            if (out) memcpy(&out[idx], seq, n);
+            idx += n;
+            j += n - 1;
+            c0 += w;
+        }
+    }
+    *col = c0;
+    return idx;
+}
+
+// this converts a chars index into the column of the screen it's drawn at, counting from the start of the row. in a row that's all ASCII that's the same as its render index, and only rows with other characters in them have to be decoded, from the last checkpoint before cx if the row is long enough to have them
+int editorRowCxToCol(erow *row, int cx) {
+    if (!(row->flags & ROW_UTF8)) return editorRowCxToRx(row, cx);
+    editorRowRender(row);
+    int from = 0, col = 0;
+    if (row->flags & ROW_WINDOWED) {
+        struct rowMark *m = &row->marks[editorRowMarksUpTo(row, offsetof(struct rowMark, cx), cx) - 1];
+        from = m->cx;
+        col = m->col;
+    }
+    editorRowExpand(row, from, cx, &col, NULL, 0, 0);
+    return col;
+}
+
+// this makes sure hl and render have room for needed bytes of a row. we only go back to the allocator when render has outgrown what we allocated last time, and then we grow it by half again so that a row that keeps getting longer doesn't reallocate on every keystroke. hl is always the same length as render, so it grows along with it
+void editorRowReserve(erow *row, int needed) {
+    if (needed > row->rcap) {
+        int cap = poolSize(needed + needed / 2);
+        if (row->render) row->render = poolRealloc(row->render, row->rcap, cap);
+        row->hl = poolRealloc(row->hl, row->rcap, cap);
+        row->rcap = cap;
+    }
+}
+
+// this makes sure the window of a long row that's rendered covers the columns on the screen, from E.coloff to E.coloff + E.screencols. if it doesn't, it moves there, and gets rendered and highlighted starting from the checkpoint it starts at
+// // the window starts at the last checkpoint at or before E.coloff, and ends one checkpoint past the first one at or after the right edge of the screen, so that the highlighter can look past the edge at a keyword or comment delimiter that's cut in half by it
+void editorRowWindow(erow *row) {
+    if (!(row->flags & ROW_WINDOWED)) return;
+    int from = editorRowMarksUpTo(row, offsetof(struct rowMark, col), E.coloff) - 1;
+    int to = editorRowMarksUpTo(row, offsetof(struct rowMark, col), E.coloff + E.screencols - 1);
+    if (to < row->nmarks) to++;
+    if (row->wfrom >= 0 && row->wfrom <= from && row->wto >= to) return;
+
+    struct rowMark *m = &row->marks[from];
+    int end = to < row->nmarks ? row->marks[to].cx : row->size;
+    int tabs = editorRowTabsBefore(row, end) - editorRowTabsBefore(row, m->cx);
+    editorRowReserve(row, end - m->cx + tabs * (KILO_TAB_STOP - 1) + 1);
+    if (!row->render) row->render = poolAlloc(row->rcap);
+    int col = m->col;
+    row->rsize = editorRowExpand(row, m->cx, end, &col, row->render, 0, 0);
+    row->render[row->rsize] = '\0';
+    row->rbase = m->rx;
+    row->cbase = m->col;
+    editorHighlightRun(row->render, row->rsize, row->hl, m->state, NULL, NULL);
+    row->wfrom = from;
+    row->wto = to;
+}
+
+// this highlights a row that's too long to render all at once from its start, starting out inside a multi-line comment if in_comment is set. the highlighting is thrown away, and all we keep is the checkpoints along the row, which its window is highlighted from. it returns whether the row ends inside a multi-line comment, like editorHighlight()
+// // it also fills in the row's table of tabs, which editorUpdateRow() has made room for
+int editorRowMarkSyntax(erow *row, int in_comment) {
+    int need = row->size / KILO_ROW_MARK + 2;
+    if (need > row->markcap) {
+        int cap = poolSize(sizeof(struct rowMark) * need) / sizeof(struct rowMark);
+        row->marks = poolRealloc(row->marks, sizeof(struct rowMark) * row->markcap, sizeof(struct rowMark) * cap);
+        row->markcap = cap;
     }
-    // this return statement is just in case the caller provides an rx that's out of range, which shouldn't happen
-    return cx;
+    int state = editorHighlightRun(editorRowText(row), row->size, editorHlScratch(row->size), in_comment ? HLS_COMMENT : HLS_SEP, row->marks, &row->nmarks);
+
+    // the highlighter only tells us where each checkpoint is in chars, so we go through the row from one checkpoint to the next to find out where they are in render and on the screen, and fill in the table of tabs on the way
+    int col = 0, cx = 0, rx = 0;
+    row->ntabs = 0;
+    for (int k = 0; k < row->nmarks; k++) {
+        struct rowMark *m = &row->marks[k];
+        rx += editorRowExpand(row, cx, m->cx, &col, NULL, 1, rx);
+        cx = m->cx;
+        m->rx = rx;
+        m->col = col;
+    }
+    editorRowExpand(row, cx, row->size, &col, NULL, 1, rx);
+    row->wfrom = -1;
+    editorRowWindow(row);
+    return state == HLS_COMMENT;
 }
 
 // this function uses the chars string of an erow to fill in the contents of the render string. we'll copy each character from chars to render
@@ -553,216 +2335,1071 @@ void editorUpdateRow(erow *row) {
     int j;
     // first we have to loop through the chars of the row and count the tabs in order to know how much memory to allocate for render
     for (j = 0; j < row->size; j++) {
-        if (row->chars[j] == '\t') {
+        if (ROW_CHAR(row, j) == '\t') {
             tabs++;
         }
     }
 
-    free(row->render);
-    row->render = malloc(row->size + tabs*(KILO_TAB_STOP - 1) + 1);
+    // a row that's all ASCII has a byte of render for each column of the screen. we check both sides of the gap
+    int ascii = editorIsAscii(row->chars, row->gap) && editorIsAscii(&row->chars[row->gap + row->gaplen], row->size - row->gap);
+    if (ascii) row->flags &= ~ROW_UTF8;
+    else row->flags |= ROW_UTF8;
+
+    // the table of where the tabs are gets rebuilt along with render. it only ever grows, like render does
+    row->ntabs = 0;
+    if (tabs > row->tabcap) {
+        int cap = poolSize(sizeof(struct tabStop) * tabs) / sizeof(struct tabStop);
+        row->tabs = poolRealloc(row->tabs, sizeof(struct tabStop) * row->tabcap, sizeof(struct tabStop) * cap);
+        row->tabcap = cap;
+    }
 
-    
-    int idx = 0;
-    // this for loop idx contains the number of characters we copied into row->render so we assign it to row->rsize
-    for (j = 0; j < row->size; j++) {
-        // the maximum number of characters needed for each tab is 8. row->size already counts 1 for each tab, so we multiply the number of tabs by 7 and add that to row->size to get the maximum amount of memory we'll need for that rendered row
-        if (row->chars[j] == '\t') {
-            row->render[idx++] = ' ';
-            while (idx % KILO_TAB_STOP != 0) row->render[idx++] = ' ';
-        } else {
-            row->render[idx++] = row->chars[j];
-        }
+    // a very long row, like the only line of a minified file, is far wider than the screen. rendering and highlighting all of it every time it changes would take longer than anything else we do, so editorUpdateSyntax() highlights it without keeping anything but checkpoints along it, and finds its tabs on the way. the window of it that's on the screen is the only part that gets rendered and highlighted for real
+    if (row->size > KILO_LONG_ROW) {
+        row->flags |= ROW_WINDOWED;
+        editorUpdateSyntax(row);
+        return;
     }
-    row->render[idx] = '\0';
-    row->rsize = idx;
+    row->flags &= ~ROW_WINDOWED;
+    row->rbase = row->cbase = 0;
+
+    // the maximum number of characters needed for each tab is 8. row->size already counts 1 for each tab, so we multiply the number of tabs by 7 and add that to row->size to get the maximum amount of memory we'll need for that rendered row
+    editorRowReserve(row, row->size + tabs*(KILO_TAB_STOP - 1) + 1);
+    if (!row->render) row->render = poolAlloc(row->rcap);
+
+    int col = 0;
+    // editorRowExpand() returns the number of characters we copied into row->render so we assign it to row->rsize
+    row->rsize = editorRowExpand(row, 0, row->size, &col, row->render, 1, 0);
+    row->render[row->rsize] = '\0';
 
     // we call editorUpdateSyntax() here because editorUpdateRow() already has the job of updating the render array whenever the text of a row changes, so it makes sense that this is where we'd want to update the hl array, after we've updated render above
     editorUpdateSyntax(row);
 }
 
-// erow gets constructed and initialized here
+// a row that still points into the memory-mapped file can't be written to, so before editing it we give it its own copy of its characters. the same goes for a row whose chars are in the arena, which can't grow there
+// // the copy's gap takes up whatever room its size class has left over. a row's chars always have size + gaplen + 1 bytes of room, which is what we tell the pools when the row grows or goes away
+void editorRowDetach(erow *row) {
+    if (!(row->flags & (ROW_MAPPED | ROW_ARENA))) return;
+    size_t cap = poolSize(row->size + 1);
+    char *chars = poolAlloc(cap);
+    memcpy(chars, row->chars, row->size);
+    row->chars = chars;
+    row->gap = row->size;
+    row->gaplen = cap - row->size - 1;
+    row->chars[row->size + row->gaplen] = '\0';
+    row->flags &= ~(ROW_MAPPED | ROW_ARENA);
+}
+
+// rows from a memory-mapped file don't get rendered until they are needed. this renders the row if it hasn't been rendered yet, and rehighlights it if the state it starts in has changed
+void editorRowRender(erow *row) {
+    if (!row->render) editorUpdateRow(row);
+    else if (row->flags & ROW_HL_STALE) editorUpdateSyntax(row);
+}
+
+// this moves the gap so that it starts at logical position at. the characters between the old and new gap positions get shifted across the gap, so moving it is only as expensive as the distance it travels, and typing in one place never moves it at all
+void editorRowMoveGap(erow *row, int at) {
+    editorRowDetach(row);
+    if (at < row->gap) {
+        // the gap moves left, so the characters in chars[at..gap) slide to the right side of the gap
+        memmove(&row->chars[at + row->gaplen], &row->chars[at], row->gap - at);
+    } else if (at > row->gap) {
+        // the gap moves right, so the characters just after the gap slide over to its left side
+        memmove(&row->chars[row->gap], &row->chars[row->gap + row->gaplen], at - row->gap);
+    }
+    row->gap = at;
+}
+
+// this makes sure the gap has room for at least need more characters. when it doesn't, we grow the storage geometrically (to about twice the text length) so that the cost of the realloc() is amortized over many insertions
+void editorRowGrowGap(erow *row, int need) {
+    editorRowDetach(row);
+    if (row->gaplen >= need) return;
+    int tail = row->size - row->gap;
+    // the + 1 leaves room for a null byte after the text when we close the gap. the gap gets any room the size class has on top of what we asked for
+    size_t cap = poolSize(row->size + (row->size + need + KILO_GAP_MIN) + 1);
+    int newgaplen = cap - row->size - 1;
+    row->chars = poolRealloc(row->chars, row->size + row->gaplen + 1, cap);
+    // the characters after the gap were at the end of the old storage, so we move them to the end of the new storage
+    memmove(&row->chars[row->gap + newgaplen], &row->chars[row->gap + row->gaplen], tail);
+    row->gaplen = newgaplen;
+    row->chars[row->size + row->gaplen] = '\0';
+}
+
+// this moves the gap to the end of the row and returns chars, which then holds the whole text as a single null-terminated string. we use this when something needs the row's text in one contiguous piece
+char *editorRowCloseGap(erow *row) {
+    editorRowMoveGap(row, row->size);
+    row->chars[row->size] = '\0';
+    return row->chars;
+}
+
+// erow gets constructed and initialized here. chars holds the row's len characters, already copied to wherever the row keeps them, and flags says where that is
+void editorInsertRowChars(int at, char *chars, size_t len, int flags) {
+    // the row store makes room for the new row inside the block it belongs to. none of the rows after it need updating, since row indices come from the row store rather than being stored in each row
+    erow *row = rowStoreInsert(at);
+    editorHlShift(at, 1);
+
+    row->size = len;
+    row->chars = chars;
+    // a new row starts out with an empty gap at its end. the first edit will open up a real gap wherever it happens
+    row->gap = len;
+    row->gaplen = 0;
+
+    row->rsize = 0;
+    row->rcap = 0;
+    row->render = NULL;
+    row->hl = NULL;
+    row->tabs = NULL;
+    row->ntabs = 0;
+    row->tabcap = 0;
+    row->marks = NULL;
+    row->nmarks = 0;
+    row->markcap = 0;
+    row->rbase = row->cbase = 0;
+    row->wfrom = -1;
+    // the row after the new one used to start in the state of the row before the new one, so we start the new row out in that state too. that way, if the new row ends in a different state, editorUpdateSyntax() will notice and pass the change along
+    row->hl_open_comment = editorRowStartState(row);
+    row->flags = flags;
+    editorUpdateRow(row);
+
+    E.numrows++;
+    E.dirty++; // any change to the file will set the dirty flag to not equal 0
+}
+
+// this inserts a new row holding a copy of len characters from s, taken from the pools
 void editorInsertRow(int at, char *s, size_t len) {
     if (at < 0 || at > E.numrows) return;
+    editorUndoRecord(UNDO_ROWS_INSERT, at, 1, s, len);
+    char *chars = poolAlloc(len + 1);
+    memcpy(chars, s, len);
+    chars[len] = '\0';
+    editorInsertRowChars(at, chars, len, 0);
+}
+
+void editorFreeRow(erow *row) {
+    poolFree(row->render, row->rcap);
+    // rows that still point into the memory-mapped file or the arena don't own their chars
+    if (!(row->flags & (ROW_MAPPED | ROW_ARENA))) poolFree(row->chars, row->size + row->gaplen + 1);
+    poolFree(row->hl, row->rcap);
+    poolFree(row->tabs, sizeof(struct tabStop) * row->tabcap);
+    poolFree(row->marks, sizeof(struct rowMark) * row->markcap);
+}
 
-    E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-    memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
-    // we want to the idx of each row whenever a row is inserted into file
-    for (int j = at + 1; j <= E.numrows; j++) E.row[j].idx++;
+// this throws away every row of the file. the rows' own memory all comes from the arena and the pools, which are reset in one go instead of freeing the rows one at a time, so all that's left to free is the blocks
+// // the pools are shared by every buffer, though, so while there's more than one buffer each row gives its memory back to them on its own, and only the buffer's arena is reset
+void editorFreeRows(void) {
+    // a save still being written might be copying out of the mapping that goes away below
+    editorSaveWait();
+    // the rows that follow mode added come from the file the buffer is losing
+    editorFollowStop();
+    if (E.nindexjobs) editorIndexFinish();
+    // what the rows know about the file gets kept for the next time it's opened
+    editorCacheSave();
+    editorSearchClear();
+    for (int b = 0; b < E.nblocks; b++) {
+        struct rowBlock *block = E.blocks[b];
+        if (E.nbuffers > 1 && block->rows) {
+            for (int j = 0; j < block->nrows; j++) editorFreeRow(&block->rows[j]);
+        }
+        free(block->rows);
+        free(block);
+    }
+    E.nblocks = 0;
+    rowStoreRebuildTree();
+    if (E.nbuffers > 1) arenaReset(&E.rowarena);
+    else poolReset();
+    editorUndoClear();
+    if (E.map) {
+        munmap(E.map, E.mapsize);
+        close(E.mapfd);
+        E.map = NULL;
+        E.mapfd = -1;
+        E.mapsize = 0;
+        E.mapindexed = 0;
+    }
+    E.numrows = 0;
+    E.cx = E.cy = E.rx = 0;
+    E.rowoff = E.coloff = 0;
+    E.hl_frontier = INT_MAX;
+    E.hl_until = 0;
+    E.frame_valid = 0;
+}
 
-    // we initialize idx to the row's index in the file at the time that it's inserted
-    E.row[at].idx = at;
+// this is similar to editorRowDelChar() because here and there we are deleting a single element from an array of elements by its index
+void editorDelRow(int at) {
+    // first we validate the at index
+    if (at < 0 || at >= E.numrows) return;
+    erow *row = editorRowAt(at);
+    editorUndoRecord(UNDO_ROWS_DELETE, at, 1, editorRowText(row), row->size);
+    // then we free the memory owned by the row using editorFreeRow()
+    editorFreeRow(row);
+    // then we have the row store remove the row, which only moves the rows that come after it in the same block
+    rowStoreDelete(at);
+    editorHlShift(at, -1);
+    // the row that took its place now starts in the state of the row before the deleted one, which might be different
+    if (at < E.numrows - 1) {
+        erow *next = editorRowAt(at);
+        next->flags |= ROW_HL_STALE;
+        editorHlInvalidate(at, at + 1);
+    }
+    // then we decrement rows and increment the dirty flag
+    E.numrows--;
+    E.dirty++;
+}
 
-    // int at = E.numrows;
-    E.row[at].size = len;
-    E.row[at].chars = malloc(len + 1);
-    memcpy(E.row[at].chars, s, len);
-    E.row[at].chars[len] = '\0';
-    
+// this deletes count rows starting at at all at once, which only goes through each block they're in once, instead of once for every row. undo takes out the rows of a paste this way. it doesn't record anything in the undo log, since undo and redo are the only ones that use it
+void editorDelRows(int at, int count) {
+    if (at < 0 || at >= E.numrows) return;
+    if (count > E.numrows - at) count = E.numrows - at;
+    rowStoreDeleteRange(at, count);
+    editorHlShift(at, -count);
+    if (at < E.numrows - count) {
+        erow *next = editorRowAt(at);
+        next->flags |= ROW_HL_STALE;
+        editorHlInvalidate(at, at + 1);
+    }
+    E.numrows -= count;
+    E.dirty++;
+}
+
+// this puts len characters from s into the row at at. every way of adding text to a row ends up here, which is where the undo log hears about it
+void editorRowInsert(erow *row, int at, const char *s, int len) {
+    // first we validate at, which is the eindex where we want to insert the characters. at is allowed to go one character past the end of the string, in which case the characters should be inserted at the end of the string
+    if (at < 0 || at > row->size) at = row->size;
+    editorUndoRecord(UNDO_INSERT, editorRowIndex(row), at, s, len);
+    // then we move the gap to the insertion point and make sure there's room in it. when the user is typing, the gap is already right there and has room, so neither of these does any work
+    editorRowMoveGap(row, at);
+    editorRowGrowGap(row, len);
+    // then we copy the characters to the start of the gap, which shrinks the gap by len
+    memcpy(&row->chars[row->gap], s, len);
+    row->gap += len;
+    row->gaplen -= len;
+    // we increase the size of the characters array
+    row->size += len;
+    // we call editorUpdateRow() so that the render and rsize fields get update with the new row content
+    editorUpdateRow(row);
+    E.dirty++; // any change to the file will set the dirty flag to not equal 0
+}
+
+// this takes the len characters starting at at out of the row, and like editorRowInsert() it's where every way of taking text out of a row ends up
+void editorRowDelete(erow *row, int at, int len) {
+    if (at < 0 || len <= 0 || at + len > row->size) return;
+    editorRowDetach(row);
+    // when the gap already starts at at, like it does when a row is split at the cursor, the characters just after the gap are the ones to delete, and the gap widens forward to swallow them. otherwise we move the gap so that it starts just after them and widen it backwards, which is the usual case for backspace, where the gap is already there
+    int forward = row->gap == at;
+    if (!forward) editorRowMoveGap(row, at + len);
+    editorUndoRecord(UNDO_DELETE, editorRowIndex(row), at, forward ? &row->chars[row->gap + row->gaplen] : &row->chars[at], len);
+    row->gap = at;
+    row->gaplen += len;
+    // then we decrease the row's size, update the row, and set the dirty flag
+    row->size -= len;
+    editorUpdateRow(row);
+    E.dirty++;
+}
+
+// this function inserts a single character into an erow, at a given position
+void editorRowInsertChar(erow *row, int at, int c) {
+    char ch = c;
+    editorRowInsert(row, at, &ch, 1);
+}
+
+// similar to editorRowInsertChar() but there's no memory management to do
+void editorRowDeleteChar(erow *row, int at) {
+    editorRowDelete(row, at, 1);
+}
+
+// appending is an insertion at the end of the row
+void editorRowAppendString(erow *row, char *s, size_t len) {
+    editorRowInsert(row, row->size, s, len);
+}
+
+/*** editor operations ***/
+
+// this section contains functions that we call from editorProcessKeys() when we're mapping keypresses to various text editiing operations
+
+// this function will take a character and use editorRowInsertChar() to insert that character into the position that the cursor is at
+// // note that this function doesn't have to handle the details of modifying an erow, and editorRowInsertChar() doesn't have to handle the cursor's location. this is the reason we have some functions in /editor operations/ and other functions in /row operations/
+void editorInsertChar(int c) {
+    E.undo_typing = 1;
+    // this if statement checks if the cursor is on the tilde line after the end of the file. if it is, then the cursor is on the tilde line after the end of the file, so we need to append a new row to the file before inserting a character there
+    if (E.cy == E.numrows) {
+        editorInsertRow(E.numrows, "", 0);
+    }
+    editorRowInsertChar(editorRowAt(E.cy), E.cx, c);
+    // after inserting the character we move the cursor forward so that the next character the user inserts will go after the one they've just inserted
+    E.cx++;
+}
+
+void editorInsertNewLine(void) {
+    // if we're at the beginning of a line, we only have to insert a new blank row before the line we're on
+    if (E.cx == 0) {
+        editorInsertRow(E.cy, "", 0);
+    // if we're not at the beginning of a line, we have to split the current line into row rows
+    } else {
+        erow *row = editorRowAt(E.cy);
+        // we move the gap to the cursor first, so that everything after the cursor sits in one piece right after the gap
+        editorRowMoveGap(row, E.cx);
+        // first we call editorInsertRow() and pass it the characters on the current row after the cursor. this creates a new row after the current one with all the characters that were previously in the current row
+        editorInsertRow(E.cy + 1, &row->chars[row->gap + row->gaplen], row->size - E.cx); // this called function includes a call to editorUpdateRow() for the new row
+        // then we look the row up again because editorInsertRow() may have moved rows around inside their block, which invalidates the pointer
+        row = editorRowAt(E.cy);
+        // then we truncate the current row's contents. the gap is already at the cursor, so editorRowDelete() only has to fold everything after the cursor into it
+        editorRowDelete(row, E.cx, row->size - E.cx);
+    }
+    // in both cases we increment E.cy since there's a new row in the file
+    E.cy++;
+    // we also set E.cx to 0 to move the cursor to the beginning of the row
+    E.cx = 0;
+}
+
+// this inserts len characters of text at the cursor all at once, which is how a paste goes in. each line break in the text, whether it's '\r', '\n' or "\r\n", starts a new row, and the cursor ends up after the last character inserted
+void editorInsertText(const char *s, int len) {
+    if (len == 0) return;
+    if (E.cy == E.numrows) {
+        editorInsertRow(E.numrows, "", 0);
+    }
+    // everything after the cursor is taken off the row, and goes back on the end of the last line of the inserted text
+    erow *row = editorRowAt(E.cy);
+    editorRowMoveGap(row, E.cx);
+    int taillen = row->size - E.cx;
+    char *tail = kmalloc(taillen + 1);
+    memcpy(tail, &row->chars[row->gap + row->gaplen], taillen);
+    editorRowDelete(row, E.cx, taillen);
+
+    int i = 0;
+    int first = 1;
+    while (1) {
+        int j = i;
+        while (j < len && s[j] != '\r' && s[j] != '\n') j++;
+        // the first line goes on the end of the row the cursor is on, and each line after that gets a row of its own
+        if (first) {
+            editorRowAppendString(editorRowAt(E.cy), (char *) &s[i], j - i);
+            E.cx += j - i;
+        } else {
+            E.cy++;
+            editorInsertRow(E.cy, (char *) &s[i], j - i);
+            E.cx = j - i;
+        }
+        if (j == len) break;
+        if (s[j] == '\r' && j + 1 < len && s[j + 1] == '\n') j++;
+        i = j + 1;
+        first = 0;
+    }
+    editorRowAppendString(editorRowAt(E.cy), tail, taillen);
+    free(tail);
+}
+
+void editorDelChar(void) {
+    // if the cursor is past the end of the file so there's nothing to delete and we do nothing
+    if (E.cy == E.numrows) return;
+    // we're at the beginning of the first line so there's nothing to do and we do nothing
+    if (E.cx == 0 && E.cy == 0) return;
+
+    // if the cursor is within the bounds of the file we get the erow the cursor is on
+    erow *row = editorRowAt(E.cy);
+    // then we check if there's a character to the left of the cursor, delete it, and move the cursor one space to the left
+    if (E.cx > 0) {
+        // backspace deletes a whole character, all of its bytes
+        E.undo_typing = 1;
+        int from = E.cx - 1;
+        while (from > 0 && UTF8_CONT(ROW_CHAR(row, from))) from--;
+        while (E.cx > from) {
+            editorRowDeleteChar(row, E.cx - 1);
+            E.cx--;
+        }
+    } else {
+        // if we find that E.cx == 0, we call editorAppendString() and editorDelRow as we planned
+        // row points to the row we are deleting, so we append row->chars to the previous row, then delete the row that E.cy is on
+        // then we set E.cx to the end of the contents of the previous row before appending that row, that way the cursor will end up at the point where the two lines joined
+        erow *prev = editorRowAt(E.cy - 1);
+        E.cx = prev->size;
+        editorRowAppendString(prev, editorRowCloseGap(row), row->size);
+        editorDelRow(E.cy);
+        E.cy--;
+    }
+}
+
+// this puts the cursor at cy, cx, moving it back inside the file if that's past the end of the file or of the row. undo and redo put the cursor back where it was, which is always inside the file, but a window on a buffer that was changed in another window can have its cursor left anywhere
+void editorSetCursor(int cy, int cx) {
+    if (cy > E.numrows) cy = E.numrows;
+    if (cy < 0) cy = 0;
+    int size = cy < E.numrows ? editorRowAt(cy)->size : 0;
+    E.cy = cy;
+    E.cx = cx > size ? size : cx < 0 ? 0 : cx;
+}
+
+/*** undo ***/
+
+// these copy bytes into and out of the ring the undo log is kept in, at a position in the log, wrapping around the end of the ring when they get to it
+void undoWrite(unsigned long long pos, const void *src, size_t len) {
+    size_t at = pos % KILO_UNDO_BYTES;
+    size_t first = len < KILO_UNDO_BYTES - at ? len : KILO_UNDO_BYTES - at;
+    memcpy(&E.undo[at], src, first);
+    memcpy(E.undo, (const char *) src + first, len - first);
+}
+void undoRead(unsigned long long pos, void *dst, size_t len) {
+    size_t at = pos % KILO_UNDO_BYTES;
+    size_t first = len < KILO_UNDO_BYTES - at ? len : KILO_UNDO_BYTES - at;
+    memcpy(dst, &E.undo[at], first);
+    memcpy((char *) dst + first, E.undo, len - first);
+}
+
+// the room a record with len bytes of text takes up in the log, counting its header and the size written after it
+size_t undoSize(int len) {
+    return sizeof(struct undoRecord) + len + sizeof(int);
+}
+
+// the room the text of an edit takes up in a record. the rows records keep each row's length in front of it
+int undoTextSize(int type, int len) {
+    return type >= UNDO_ROWS_INSERT ? len + (int) sizeof(int) : len;
+}
+
+// this writes the text of a record at pos, with the row's length in front of it for the rows records
+void undoWriteText(unsigned long long pos, int type, const char *text, int len) {
+    if (type >= UNDO_ROWS_INSERT) {
+        undoWrite(pos, &len, sizeof(int));
+        pos += sizeof(int);
+    }
+    undoWrite(pos, text, len);
+}
+
+// this makes room for len more bytes at the end of the log by dropping its oldest records, but never the record at keep. it returns 0 if it couldn't make enough room
+int undoReserve(size_t len, unsigned long long keep) {
+    if (!E.undo) E.undo = kmalloc(KILO_UNDO_BYTES);
+    while (E.undo_head + len - E.undo_tail > KILO_UNDO_BYTES) {
+        if (E.undo_tail == E.undo_head || E.undo_tail == keep) return 0;
+        struct undoRecord r;
+        undoRead(E.undo_tail, &r, sizeof(r));
+        E.undo_tail += undoSize(r.len);
+    }
+    return 1;
+}
+
+// this tries to merge an edit into the newest record, which works when the edit carries on from where the record's edit left off: typing just after the text it put in, deleting just before or just after the text it took out, or putting rows in just after the ones it put in. it returns 1 if it merged the edit, 0 if the edit doesn't carry on from the record, and -1 if it does but the record has already grown as long as it can
+int undoMerge(int type, int row, int col, const char *text, int len) {
+    struct undoRecord r;
+    undoRead(E.undo_last, &r, sizeof(r));
+    if (r.type != type) return 0;
+    int before = 0; // whether the edit's text goes in front of the record's, which is how backspace carries on
+    if (type == UNDO_INSERT && r.row == row && r.col + r.len == col) before = 0;
+    else if (type == UNDO_DELETE && r.row == row && r.col == col) before = 0;
+    else if (type == UNDO_DELETE && r.row == row && col + len == r.col) before = 1;
+    else if (type == UNDO_ROWS_INSERT && r.row + r.col == row) before = 0;
+    else return 0;
+
+    int add = undoTextSize(type, len);
+    // putting the text in front means moving the record's own text up, so runs of typing are kept short enough for that to take no time. a paste's rows only ever go on the end, and can run on for up to a quarter of the log
+    int most = type >= UNDO_ROWS_INSERT ? KILO_UNDO_BYTES / 4 : KILO_UNDO_RUN;
+    if (r.len + add > most || !undoReserve(add, E.undo_last)) return -1;
+
+    unsigned long long at = E.undo_last + sizeof(r);
+    if (before) {
+        char old[KILO_UNDO_RUN];
+        undoRead(at, old, r.len);
+        undoWrite(at + len, old, r.len);
+        undoWrite(at, text, len);
+        r.col = col;
+    } else {
+        undoWriteText(at + r.len, type, text, len);
+        if (type == UNDO_ROWS_INSERT) r.col += col;
+    }
+    r.len += add;
+    int size = undoSize(r.len);
+    undoWrite(E.undo_last, &r, sizeof(r));
+    undoWrite(E.undo_last + size - sizeof(int), &size, sizeof(int));
+    E.undo_head = E.undo_cur = E.undo_last + size;
+    return 1;
+}
+
+// this adds an edit to the undo log. the row operations call it for every change they make to the text, with the text they put in or took out. for the rows records, col is the number of rows, and the text is a single row, without a newline after it
+// // the log only holds the text that changed and where, never copies of whole rows, so undoing a paste of a huge number of lines is a handful of records, one of which puts all of the lines back or takes them all out
+void editorUndoRecord(int type, int row, int col, const char *text, int len) {
+    if (E.undo_replay || (len == 0 && type < UNDO_ROWS_INSERT)) return;
+    // whatever was undone can't be redone any more once something else has changed. if the file was saved in the middle of it, there's no getting back to what's on the disk anymore either
+    if (E.undo_cur != E.undo_head) {
+        if (E.undo_saved != ULLONG_MAX && E.undo_saved > E.undo_cur) E.undo_saved = ULLONG_MAX;
+        if (E.savejob && E.savejob->undo_at != ULLONG_MAX && E.savejob->undo_at > E.undo_cur) E.savejob->undo_at = ULLONG_MAX;
+        E.undo_head = E.undo_cur;
+        E.undo_last = ULLONG_MAX;
+    }
+    // the edits of one keypress are merged together wherever they can be, and so is a run of typing over many keypresses
+    if (E.undo_last != ULLONG_MAX && (!E.undo_step || (E.undo_typing && E.undo_lasttyping && type < UNDO_ROWS_INSERT))) {
+        int merged = undoMerge(type, row, col, text, len);
+        if (merged) {
+            E.undo_step = 0;
+            E.undo_lasttyping = E.undo_typing;
+        }
+        if (merged == 1) return;
+    }
+
+    int add = undoTextSize(type, len);
+    int size = undoSize(add);
+    if (!undoReserve(size, ULLONG_MAX)) {
+        // an edit too big for the log can't be undone, and neither can anything before it, since undoing those would put text back in places this edit has changed
+        editorUndoClear();
+        E.undo_saved = ULLONG_MAX;
+        editorSetStatusMessage("That change is too big to be undone");
+        return;
+    }
+    struct undoRecord r = {type, E.undo_step, row, col, add, E.undo_cy, E.undo_cx, E.cy, E.cx};
+    undoWrite(E.undo_head, &r, sizeof(r));
+    undoWriteText(E.undo_head + sizeof(r), type, text, len);
+    undoWrite(E.undo_head + size - sizeof(int), &size, sizeof(int));
+    E.undo_last = E.undo_head;
+    E.undo_head = E.undo_cur = E.undo_head + size;
+    E.undo_step = 0;
+    E.undo_lasttyping = E.undo_typing;
+}
+
+// this forgets every edit in the log, which we do when a file is opened
+void editorUndoClear(void) {
+    E.undo_tail = E.undo_cur = E.undo_head = 0;
+    E.undo_last = ULLONG_MAX;
+    E.undo_saved = 0;
+}
+
+// undo and redo call this when they're done, since they might have taken the text back to what was last saved
+void editorUndoDirty(void) {
+    if (E.undo_cur == E.undo_saved) E.dirty = 0;
+}
+
+// editorProcessKeypress() calls these around each key. the first record a key makes starts a new step, and the cursor from before and after it is kept in the step, for undo and redo to put it back
+void editorUndoBegin(void) {
+    E.undo_step = 1;
+    E.undo_typing = 0;
+    E.undo_cy = E.cy;
+    E.undo_cx = E.cx;
+}
+void editorUndoEnd(void) {
+    if (E.undo_step || E.undo_last == ULLONG_MAX) return;
+    struct undoRecord r;
+    undoRead(E.undo_last, &r, sizeof(r));
+    r.ay = E.cy;
+    r.ax = E.cx;
+    undoWrite(E.undo_last, &r, sizeof(r));
+}
+
+// this makes the edit the record at pos describes, or if forward isn't set, the opposite edit, which undoes it
+void editorUndoApply(struct undoRecord *r, unsigned long long pos, int forward) {
+    char *text = kmalloc(r->len);
+    undoRead(pos + sizeof(*r), text, r->len);
+    switch (forward ? r->type : r->type ^ 1) {
+        case UNDO_INSERT:
+            editorRowInsert(editorRowAt(r->row), r->col, text, r->len);
+            break;
+        case UNDO_DELETE:
+            editorRowDelete(editorRowAt(r->row), r->col, r->len);
+            break;
+        case UNDO_ROWS_INSERT:
+            {
+                char *p = text;
+                char *end = text + r->len;
+                int j;
+                for (j = 0; j < r->col && end - p >= (int) sizeof(int); j++) {
+                    int len;
+                    memcpy(&len, p, sizeof(int));
+                    p += sizeof(int);
+                    if (len < 0 || len > end - p) break;
+                    editorInsertRow(r->row + j, p, len);
+                    p += len;
+                }
+                // a record's rows always take up all of its text. if they don't, the log has been damaged, and what was put back isn't what was taken out
+                if (j != r->col || p != end) editorSetStatusMessage("The undo log is damaged, so that undo wasn't complete");
+            }
+            break;
+        case UNDO_ROWS_DELETE:
+            // however many rows the record holds, they go in one call, which deals with each block they're in once
+            editorDelRows(r->row, r->col);
+            break;
+    }
+    free(text);
+}
+
+// this undoes the newest step that hasn't been undone, going back through its records one at a time, newest first, until it gets to the one the step started with
+void editorUndo(void) {
+    if (E.undo_cur == E.undo_tail) {
+        editorSetStatusMessage("Nothing to undo");
+        return;
+    }
+    struct undoRecord r;
+    E.undo_replay = 1;
+    do {
+        int size;
+        undoRead(E.undo_cur - sizeof(int), &size, sizeof(int));
+        E.undo_cur -= size;
+        undoRead(E.undo_cur, &r, sizeof(r));
+        editorUndoApply(&r, E.undo_cur, 0);
+    } while (!r.step && E.undo_cur > E.undo_tail);
+    E.undo_replay = 0;
+    // nothing can be merged into a record that's been undone
+    E.undo_last = ULLONG_MAX;
+    editorUndoDirty();
+    editorSetCursor(r.cy, r.cx);
+}
+
+// and this makes the oldest step that was undone again, going forward through its records until it gets to the start of the next step
+void editorRedo(void) {
+    if (E.undo_cur == E.undo_head) {
+        editorSetStatusMessage("Nothing to redo");
+        return;
+    }
+    struct undoRecord r;
+    int step;
+    E.undo_replay = 1;
+    do {
+        undoRead(E.undo_cur, &r, sizeof(r));
+        editorUndoApply(&r, E.undo_cur, 1);
+        E.undo_cur += undoSize(r.len);
+        step = 1;
+        if (E.undo_cur < E.undo_head) undoRead(E.undo_cur + offsetof(struct undoRecord, step), &step, sizeof(int));
+    } while (!step);
+    E.undo_replay = 0;
+    E.undo_last = ULLONG_MAX;
+    editorUndoDirty();
+    editorSetCursor(r.ay, r.ax);
+}
+
+/*** session cache ***/
+
+// opening a big file means indexing every line of it and highlighting all the way through it, and that's the same work each time the same file is opened. when KILO_CACHE names a directory, the editor keeps what that work found out about each file that's big enough to need the indexing threads in a cache file there, so that the next time the file is opened the editor is ready right away, at the same place in the file
+// // a cache file is named after the device and inode of the file it's for, so a file keeps its cache when it's renamed, and a new file that takes an old one's name doesn't get the old one's cache
+
+// this gives us the name of the cache file for the file on device dev with inode ino. the caller frees it
+char *editorCachePath(dev_t dev, ino_t ino) {
+    size_t len = strlen(E.cachedir) + 64;
+    char *path = kmalloc(len);
+    snprintf(path, len, "%s/kilo-%llx-%llx.cache", E.cachedir, (unsigned long long) dev, (unsigned long long) ino);
+    return path;
+}
+
+// this tells us which entry of HLDB the current buffer is highlighted with, plus one, or 0 if it isn't highlighted
+uint32_t editorCacheSyntax(void) {
+    return E.highlighter ? (uint32_t) (E.highlighter - HLDB_compiled) + 1 : 0;
+}
+
+// this checks that block still holds the lines of the mapping it was indexed with, starting at offset off. a block that was never loaded can't have changed, but a loaded one might have had rows edited, added or taken out of it, and then its lines aren't where its mapoff and maplen say anymore
+int editorCacheBlockGood(struct rowBlock *block, size_t off) {
+    if (block->mapoff != off || block->maplen == 0 || off + block->maplen > E.mapsize) return 0;
+    if (!block->rows) return 1;
+    char *p = &E.map[block->mapoff];
+    char *end = p + block->maplen;
+    for (int j = 0; j < block->nrows; j++) {
+        erow *row = &block->rows[j];
+        int len;
+        char *next = editorMapLine(p, end, &len);
+        if (!(row->flags & ROW_MAPPED) || row->chars != p || row->size != len) return 0;
+        p = next;
+    }
+    return p == end;
+}
+
+// this writes n into the session cache at p, seven bits to a byte, and returns where the next number goes
+unsigned char *editorCachePut(unsigned char *p, uint64_t n) {
+    while (n >= 0x80) {
+        *p++ = (n & 0x7f) | 0x80;
+        n >>= 7;
+    }
+    *p++ = n;
+    return p;
+}
+
+// this reads a number editorCachePut() wrote at p into n, and returns where the next one starts, or NULL if the number runs past end or is too big to be one
+const unsigned char *editorCacheGet(const unsigned char *p, const unsigned char *end, uint64_t *n) {
+    *n = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        unsigned char c = *p++;
+        *n |= (uint64_t) (c & 0x7f) << shift;
+        if (!(c & 0x80)) return p;
+    }
+    return NULL;
+}
+
+// a cache file's name is put together by editorCachePath(), and the one it's written to before it's renamed into place has a few more characters after that
+int editorCacheName(const char *name) {
+    return strncmp(name, "kilo-", 5) == 0 && strstr(name, ".cache") != NULL;
+}
+
+struct cacheFile {
+    char *name;
+    time_t mtime;
+};
+
+// qsort() comparator that puts the cache files that were written last first
+int editorCacheNewer(const void *a, const void *b) {
+    time_t x = ((const struct cacheFile *) a)->mtime;
+    time_t y = ((const struct cacheFile *) b)->mtime;
+    return (x < y) - (x > y);
+}
+
+// this keeps the cache directory from growing without end: every file opened once leaves a cache behind, so we only keep the KILO_CACHE_FILES newest ones. a cache is written again each time its file is closed, so the newest ones are the ones that were used last
+void editorCachePrune(void) {
+    DIR *dir = opendir(E.cachedir);
+    if (!dir) return;
+    struct cacheFile *files = NULL;
+    int n = 0, cap = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        struct stat st;
+        if (!editorCacheName(ent->d_name) || fstatat(dirfd(dir), ent->d_name, &st, 0) == -1 || !S_ISREG(st.st_mode)) continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            files = krealloc(files, sizeof(struct cacheFile) * cap);
+        }
+        files[n].name = strdup(ent->d_name);
+        files[n].mtime = st.st_mtime;
+        n++;
+    }
+    if (n > KILO_CACHE_FILES) qsort(files, n, sizeof(struct cacheFile), editorCacheNewer);
+    for (int j = 0; j < n; j++) {
+        if (j >= KILO_CACHE_FILES) unlinkat(dirfd(dir), files[j].name, 0);
+        free(files[j].name);
+    }
+    free(files);
+    closedir(dir);
+}
+
+// this writes the current buffer's session cache, when it has one worth writing. it's called when the buffer's rows are about to be thrown away, and for every buffer when the editor quits
+// // the cache is written to a new file that's renamed over the old one, like a save, so a cache is never read while it's half written. unlike a save we don't fsync() it, since a cache lost in a crash only means the next open takes as long as it would have anyway, and a cut short one doesn't pass the checks editorCacheLoad() makes
+void editorCacheSave(void) {
+    if (!E.cachedir || !E.map || E.dirty || E.mapsize < KILO_INDEX_CHUNK) return;
+    if (E.nindexjobs) editorIndexFinish();
+    if (E.mapindexed != E.mapsize) return;
+    // the rows are only worth keeping if they're still what's on the disk. a file that was saved over has been replaced by a new one, and no longer has a name
+    struct stat st;
+    if (fstat(E.mapfd, &st) == -1 || st.st_nlink == 0 || (size_t) st.st_size != E.mapsize || st.st_mtim.tv_sec != E.mapmtime.tv_sec || st.st_mtim.tv_nsec != E.mapmtime.tv_nsec) return;
+
+    char *buf = kcalloc(1, sizeof(struct cacheHeader) + (size_t) CACHE_BLOCK_MAX * E.nblocks);
+    struct cacheHeader *h = (struct cacheHeader *) buf;
+    unsigned char *rec = (unsigned char *) (h + 1);
+    memcpy(h->magic, KILO_CACHE_MAGIC, sizeof(h->magic));
+    h->dev = st.st_dev;
+    h->ino = st.st_ino;
+    h->size = E.mapsize;
+    h->mtime = E.mapmtime.tv_sec;
+    h->mtime_nsec = E.mapmtime.tv_nsec;
+    h->nblocks = E.nblocks;
+    h->numrows = E.numrows;
+    h->syntax = editorCacheSyntax();
+
+    // every block before the one the background highlighter has got to knows the state its last line ends in. those are the checkpoints rowBlockLoad() starts from, and they're kept for as far into the file as they go without a gap
+    int off;
+    int frontier = E.hl_frontier < E.numrows ? rowStoreFind(E.hl_frontier, &off) : E.nblocks;
+    int known = 1;
+    size_t at = 0;
+    for (int b = 0; b < E.nblocks; b++) {
+        struct rowBlock *block = E.blocks[b];
+        if (!editorCacheBlockGood(block, at)) {
+            free(buf);
+            return;
+        }
+        known = known && b < frontier && block->hl_scanned;
+        rec = editorCachePut(rec, block->maplen);
+        rec = editorCachePut(rec, block->nrows);
+        rec = editorCachePut(rec, known ? CACHE_SCANNED | (rowBlockEndState(block) ? CACHE_HL_OUT : 0) : 0);
+        at += block->maplen;
+    }
+    if (at != E.mapsize) {
+        free(buf);
+        return;
+    }
+
+    // the cursor comes from the window the cursor is in if it shows this buffer, and from the first other window that does if it doesn't
+    if (E.windows[E.curwin].buf == E.curbuf) {
+        h->cy = E.cy;
+        h->cx = E.cx;
+        h->rowoff = E.rowoff;
+        h->coloff = E.coloff;
+    } else {
+        for (int w = 0; w < E.nwindows; w++) {
+            if (E.windows[w].buf != E.curbuf) continue;
+            h->cy = E.windows[w].cy;
+            h->cx = E.windows[w].cx;
+            h->rowoff = E.windows[w].rowoff;
+            h->coloff = E.windows[w].coloff;
+            break;
+        }
+    }
+
+    char *path = editorCachePath(st.st_dev, st.st_ino);
+    size_t tmplen = strlen(path) + 8;
+    char *tmp = kmalloc(tmplen);
+    snprintf(tmp, tmplen, "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd != -1) {
+        char *p = buf;
+        size_t left = (char *) rec - buf;
+        while (left > 0) {
+            ssize_t n = write(fd, p, left);
+            if (n <= 0) break;
+            p += n;
+            left -= n;
+        }
+        if (close(fd) == -1 || left > 0 || rename(tmp, path) == -1) unlink(tmp);
+        else editorCachePrune();
+    }
+    free(tmp);
+    free(path);
+    free(buf);
+}
+
+// this builds the row store of the file that was just mapped, whose fstat() is st, out of its session cache, and returns whether it could. a cache that doesn't match the file, or that doesn't make sense, is left alone and the file gets indexed like it has no cache
+// // the blocks come out just like the indexer makes them, not loaded, and the ones whose end states the background highlighter had worked out get those back, so it only has to go through the rest of the file
+int editorCacheLoad(struct stat *st) {
+    if (!E.cachedir || E.mapsize < KILO_INDEX_CHUNK) return 0;
+    char *path = editorCachePath(st->st_dev, st->st_ino);
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd == -1) return 0;
+    struct stat cst;
+    char *cache = MAP_FAILED;
+    if (fstat(fd, &cst) == 0 && (size_t) cst.st_size >= sizeof(struct cacheHeader)) {
+        cache = mmap(NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (cache == MAP_FAILED) return 0;
+
+    const struct cacheHeader *h = (const struct cacheHeader *) cache;
+    const unsigned char *rec = (const unsigned char *) (h + 1);
+    const unsigned char *recend = (const unsigned char *) cache + cst.st_size;
+    // every cacheBlock takes at least a byte for each of its three numbers, so a header asking for more of them than that would fit in the rest of the file is no good
+    int ok = memcmp(h->magic, KILO_CACHE_MAGIC, sizeof(h->magic)) == 0 && h->dev == (uint64_t) st->st_dev && h->ino == (uint64_t) st->st_ino && h->size == E.mapsize && h->mtime == (int64_t) st->st_mtim.tv_sec && h->mtime_nsec == (int64_t) st->st_mtim.tv_nsec && h->nblocks <= (size_t) (recend - rec) / 3 && h->numrows <= INT_MAX;
+    // the blocks have to cover the whole file, with no more lines in each than a block can hold, and each one has to end right after a newline, except the last one, whose line might not have one. a cache that was written for a different version of the file, one that happens to be the same size and have the same modification time, most likely has a block end somewhere else, and then we'd be better off indexing the file again
+    struct cacheBlock *recs = ok ? kmalloc(sizeof(struct cacheBlock) * (h->nblocks ? h->nblocks : 1)) : NULL;
+    uint64_t total = 0;
+    uint64_t rows = 0;
+    for (size_t j = 0; ok && j < h->nblocks; j++) {
+        uint64_t maplen, nrows, flags;
+        if ((rec = editorCacheGet(rec, recend, &maplen)) == NULL || (rec = editorCacheGet(rec, recend, &nrows)) == NULL || (rec = editorCacheGet(rec, recend, &flags)) == NULL) {
+            ok = 0;
+            break;
+        }
+        if (nrows == 0 || nrows > KILO_BLOCK_ROWS || maplen == 0 || maplen > E.mapsize - total) ok = 0;
+        else if (j + 1 < h->nblocks && E.map[total + maplen - 1] != '\n') ok = 0;
+        recs[j].maplen = maplen;
+        recs[j].nrows = nrows;
+        recs[j].flags = flags;
+        total += maplen;
+        rows += nrows;
+    }
+    if (!ok || rec != recend || total != E.mapsize || rows != h->numrows) {
+        free(recs);
+        munmap(cache, cst.st_size);
+        return 0;
+    }
+
+    // the end states were worked out for a filetype, and are no good for another, which the file gets when it's opened under a name with a different extension
+    int known = h->syntax == editorCacheSyntax();
+    int first = E.numrows;
+    size_t at = 0;
+    for (size_t j = 0; j < h->nblocks; j++) {
+        struct rowBlock *block = kcalloc(1, sizeof(struct rowBlock));
+        block->mapoff = at;
+        block->maplen = recs[j].maplen;
+        block->nrows = recs[j].nrows;
+        known = known && (recs[j].flags & CACHE_SCANNED);
+        if (known) {
+            block->hl_scanned = 1;
+            block->hl_out = (recs[j].flags & CACHE_HL_OUT) != 0;
+            first += block->nrows;
+        }
+        rowStoreAddBlock(E.nblocks, block);
+        E.numrows += block->nrows;
+        at += block->maplen;
+    }
+    E.mapindexed = E.mapsize;
+    editorHlInvalidate(first, E.numrows);
+
+    editorSetCursor(h->cy, h->cx);
+    E.rowoff = h->rowoff < (uint32_t) E.numrows ? (int) h->rowoff : E.cy;
+    E.coloff = h->coloff < (uint32_t) INT_MAX ? (int) h->coloff : 0;
+    free(recs);
+    munmap(cache, cst.st_size);
+    return 1;
+}
 
-    E.row[at].rsize = 0;
-    E.row[at].render = NULL;
-    E.row[at].hl = NULL;
-    E.row[at].hl_open_comment = 0;
-    editorUpdateRow(&E.row[at]);
+/*** file i/o ***/
 
-    E.numrows++;
-    E.dirty++; // any change to the file will set the dirty flag to not equal 0
+// this gives us a bit mask with a 1 for every newline in the KILO_SCAN_WIDTH bytes starting at p. the vector instructions compare all of the bytes against '\n' at once
+#ifdef KILO_SCAN_WIDTH
+unsigned int editorNewlineMask(const char *p) {
+#if defined(__AVX2__)
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    return (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+#elif defined(__SSE2__)
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    return (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+#else
+    // NEON has no instruction for gathering one bit from each byte, so we only use it to skip over the common case of 16 bytes with no newline, and build the mask by hand otherwise
+    uint8x16_t eq = vceqq_u8(vld1q_u8((const uint8_t *) p), vdupq_n_u8('\n'));
+    if (vmaxvq_u8(eq) == 0) return 0;
+    unsigned int mask = 0;
+    for (int j = 0; j < KILO_SCAN_WIDTH; j++) {
+        if (p[j] == '\n') mask |= 1u << j;
+    }
+    return mask;
+#endif
 }
+#endif
 
-void editorFreeRow(erow *row) {
-    free(row->render);
-    free(row->chars);
-    free(row->hl);
+// this adds a block covering E.map[start..end) and holding nrows lines to a growing array of blocks
+void editorIndexEmit(struct rowBlock ***blocks, int *n, int *cap, size_t start, size_t end, int nrows) {
+    if (*n == *cap) {
+        *cap = *cap ? *cap * 2 : 16;
+        *blocks = krealloc(*blocks, sizeof(struct rowBlock *) * *cap);
+    }
+    struct rowBlock *block = kcalloc(1, sizeof(struct rowBlock));
+    block->mapoff = start;
+    block->maplen = end - start;
+    block->nrows = nrows;
+    (*blocks)[(*n)++] = block;
 }
 
-// this is similar to editorRowDelChar() because here and there we are deleting a single element from an array of elements by its index
-void editorDelRow(int at) {
-    // first we validate the at index
-    if (at < 0 || at >= E.numrows) return;
-    // then we free the memory owned by the row using editorFreeRow()
-    editorFreeRow(&E.row[at]);
-    // then we use memmove() to overwrite the deleted row struct with the rest of the rows that come after it
-    memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
-    // we want to the idx of each row whenever a row is deleted from file
-    for (int j = at; j < E.numrows - 1; j++) E.row[j].idx--;
-    // then we decrement rows and increment the dirty flag
-    E.numrows--;
-    E.dirty++;
-}
+// this splits map[start..end), which is E.map or the mapping of the buffer an indexing job belongs to, into blocks of KILO_BLOCK_ROWS lines, and returns how many blocks it made. start must be the start of a line and end must be the end of one, or the end of the file. we only look for '\n', since a '\r' only matters right before a '\n', where rowBlockLoad() strips it off
+// // it only reads the mapping and doesn't touch the row store, so it's safe to run on many threads at once
+int editorIndexScan(const char *map, size_t start, size_t end, struct rowBlock ***out) {
+    struct rowBlock **blocks = NULL;
+    int n = 0, cap = 0;
+    size_t blockstart = start;
+    int lines = 0;
+    size_t i = start;
+
+#ifdef KILO_SCAN_WIDTH
+    for (; i + KILO_SCAN_WIDTH <= end; i += KILO_SCAN_WIDTH) {
+        unsigned int mask = editorNewlineMask(&map[i]);
+        if (!mask) continue;
+        // most of the time the block isn't full yet, so we just count the newlines. only when the block fills up do we need to find exactly which newline ends it
+        int count = __builtin_popcount(mask);
+        if (lines + count < KILO_BLOCK_ROWS) {
+            lines += count;
+            continue;
+        }
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (++lines == KILO_BLOCK_ROWS) {
+                editorIndexEmit(&blocks, &n, &cap, blockstart, i + bit + 1, lines);
+                blockstart = i + bit + 1;
+                lines = 0;
+            }
+        }
+    }
+#endif
+    // whatever is left over after the last full vector, or the whole piece when we have no vector instructions, is looked through one byte at a time
+    for (; i < end; i++) {
+        if (map[i] == '\n' && ++lines == KILO_BLOCK_ROWS) {
+            editorIndexEmit(&blocks, &n, &cap, blockstart, i + 1, lines);
+            blockstart = i + 1;
+            lines = 0;
+        }
+    }
+    // the lines left over make up one last, partly filled block. a file that doesn't end in a newline has one more line after its last newline
+    if (blockstart < end) {
+        editorIndexEmit(&blocks, &n, &cap, blockstart, end, lines + (map[end - 1] != '\n'));
+    }
 
-// this function inserts a single character into an erow, at a given position
-void editorRowInsertChar(erow *row, int at, int c) {
-    // first we validate at, which is the eindex where we want to insert the character. at is allowed to go one character past the end of the string, in which case the character should be inserted at the end of the string
-    if (at < 0 || at > row->size) at = row->size;
-    // then we allocate one more byte for the chars of the erow (we add 2 because we also need room for the null byte)
-    row->chars = realloc(row->chars, row->size + 2);
-    // memmove is like memcpy() but safe to use when the  source and destination arrays overlap
-    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-    // we increment the size of the characters array
-    row->size++;
-    // then we assign the character to its position in the array
-    row->chars[at] = c;
-    // we call editorUpdateRow() so that the render and rsize fields get update with the new row content
-    editorUpdateRow(row);
-    E.dirty++; // any change to the file will set the dirty flag to not equal 0
+    *out = blocks;
+    return n;
 }
 
-// similar to editorRowInsertChar() but there's no memory management to do
-void editorRowDeleteChar(erow *row, int at) {
-    if (at < 0 || at >= row->size) return;
-    // we use memmove() to overwrite the deleted character with the characters that come after it (including the null byte)
-    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-    // then we decrement the row's size, update the row, and set the dirty flag
-    row->size--;
-    editorUpdateRow(row);
-    E.dirty++;
+// this adds the blocks made by editorIndexScan() to the end of the row store, and frees the array that held them
+void editorIndexAppend(struct rowBlock **blocks, int n, size_t end) {
+    int first = E.numrows;
+    for (int j = 0; j < n; j++) {
+        rowStoreAddBlock(E.nblocks, blocks[j]);
+        E.numrows += blocks[j]->nrows;
+    }
+    free(blocks);
+    E.mapindexed = end;
+    // the background highlighter hasn't seen the new rows yet
+    editorHlInvalidate(first, E.numrows);
 }
 
-void editorRowAppendString(erow *row, char *s, size_t len) {
-    row->chars = realloc(row->chars, row->size + len + 1);
-    // the row's new size is row->size + len + 1 so we allocate that much memory for row->chars
-    memcpy(&row->chars[row->size], s, len);
-    // then we update row->size
-    row->size += len;
-    // then we add a null byte to the end of the row
-    row->chars[row->size] = '\0';
-    // then we update the row and make sure to increment E.dirty indicate the document has been changed
-    editorUpdateRow(row);
-    E.dirty++;
+// this returns the offset just past the end of the line that offset at is in
+size_t editorIndexLineEnd(size_t at) {
+    if (at >= E.mapsize) return E.mapsize;
+    char *nl = memchr(&E.map[at], '\n', E.mapsize - at);
+    return nl ? (size_t) (nl - E.map) + 1 : E.mapsize;
 }
 
-/*** editor operations ***/
-
-// this section contains functions that we call from editorProcessKeys() when we're mapping keypresses to various text editiing operations
-
-// this function will take a character and use editorRowInsertChar() to insert that character into the position that the cursor is at
-// // note that this function doesn't have to handle the details of modifying an erow, and editorRowInsertChar() doesn't have to handle the cursor's location. this is the reason we have some functions in /editor operations/ and other functions in /row operations/
-void editorInsertChar(int c) {
-    // this if statement checks if the cursor is on the tilde line after the end of the file. if it is, then the cursor is on the tilde line after the end of the file, so we need to append a new row to the file before inserting a character there
-    if (E.cy == E.numrows) {
-        editorInsertRow(E.numrows, "", 0);
-    }
-    editorRowInsertChar(&E.row[E.cy], E.cx, c);
-    // after inserting the character we move the cursor forward so that the next character the user inserts will go after the one they've just inserted
-    E.cx++;
+// this splits the memory-mapped file into rows from E.mapindexed until at least upto bytes in, stopping at the end of a line. rather than building an erow for every line, we only note where each block's worth of lines starts, and add the block to the row store for rowBlockLoad() to build when it's needed
+void editorIndexMap(size_t upto) {
+    if (upto == 0) return;
+    size_t end = editorIndexLineEnd(upto - 1);
+    struct rowBlock **blocks;
+    int n = editorIndexScan(E.map, E.mapindexed, end, &blocks);
+    editorIndexAppend(blocks, n, end);
 }
 
-void editorInsertNewLine(void) {
-    // if we're at the beginning of a line, we only have to insert a new blank row before the line we're on
-    if (E.cx == 0) {
-        editorInsertRow(E.cy, "", 0);
-    // if we're not at the beginning of a line, we have to split the current line into row rows
-    } else {
-        erow *row = &E.row[E.cy];
-        // first we call editorInsertRow() and pass it the characters on the current row after the cursor. this creates a new row after the current one with all the characters that were previously in the current row
-        editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx); // this called function includes a call to editorUpdateRow() for the new row
-        // then we reassign the row pointer because editorInsertRow() calls realloc(), which may move memory around and invalidate the pointer
-        row = &E.row[E.cy];
-        // then we truncate the current row's contents by setting its size to the position of the cursor
-        row->size = E.cx;
-        row->chars[row->size] = '\0';
-        // then we call editorUpdateRow() on the truncated row
-        editorUpdateRow(row);
-    }
-    // in both cases we increment E.cy since there's a new row in the file
-    E.cy++;
-    // we also set E.cx to 0 to move the cursor to the beginning of the row
-    E.cx = 0;
+void *editorIndexThread(void *arg) {
+    struct indexJob *job = arg;
+    job->nblocks = editorIndexScan(job->map, job->start, job->end, &job->blocks);
+    pthread_mutex_lock(&E.indexlock);
+    job->done = 1;
+    pthread_mutex_unlock(&E.indexlock);
+    editorWake();
+    return NULL;
 }
 
-void editorDelChar(void) {
-    // if the cursor is past the end of the file so there's nothing to delete and we do nothing
-    if (E.cy == E.numrows) return;
-    // we're at the beginning of the first line so there's nothing to do and we do nothing
-    if (E.cx == 0 && E.cy == 0) return;
-
-    // if the cursor is within the bounds of the file we get the erow the cursor is on
-    erow *row = &E.row[E.cy];
-    // then we check if there's a character to the left of the cursor, delete it, and move the cursor one space to the left
-    if (E.cx > 0) {
-        editorRowDeleteChar(row, E.cx - 1);
-        E.cx--;
-    } else {
-        // if we find that E.cx == 0, we call editorAppendString() and editorDelRow as we planned
-        // row points to the row we are deleting, so we append row->chars to the previous row, then delete the row that E.cy is on
-        // then we set E.cx to the end of the contents of the previous row before appending that row, that way the cursor will end up at the point where the two lines joined
-        E.cx = E.row[E.cy - 1].size;
-        editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
-        editorDelRow(E.cy);
-        E.cy--;
+// this hands the rest of the mapping, after E.mapindexed, to background threads. we use one thread per CPU, up to KILO_INDEX_THREADS, but never give a thread less than KILO_INDEX_CHUNK bytes, since starting a thread costs more than indexing a small piece
+void editorIndexStart(void) {
+    size_t left = E.mapsize - E.mapindexed;
+    if (left == 0) return;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int n = cpus > 0 ? (int) cpus : 1;
+    if (n > KILO_INDEX_THREADS) n = KILO_INDEX_THREADS;
+    if ((size_t) n > left / KILO_INDEX_CHUNK) n = left / KILO_INDEX_CHUNK;
+    if (n < 1) n = 1;
+
+    E.indexjobs = kcalloc(n, sizeof(struct indexJob));
+    E.nindexjobs = n;
+    size_t start = E.mapindexed;
+    for (int j = 0; j < n; j++) {
+        struct indexJob *job = &E.indexjobs[j];
+        job->map = E.map;
+        // each piece gets an equal share of the bytes, with its end moved forward to the end of a line so that no line is split between two threads
+        job->start = start;
+        job->end = (j == n - 1) ? E.mapsize : editorIndexLineEnd(E.mapindexed + left / n * (j + 1));
+        if (job->end < job->start) job->end = job->start;
+        start = job->end;
+        // if we can't start a thread, we do its work right here instead
+        if (pthread_create(&job->thread, NULL, editorIndexThread, job) != 0) {
+            job->nblocks = editorIndexScan(job->map, job->start, job->end, &job->blocks);
+            job->done = 2;
+        }
     }
 }
 
-/*** file i/o ***/
-
-// this function converts our array of erow structs into a single string ready to be written out to a file
-char *editorRowsToString(int *buflen) {
-    int totlen = 0;
-    int j;
-    // first we add the lengths of each row of text, adding 1 to the total length each time for the newline character we'll add to the end of each line
-    for (j = 0; j < E.numrows; j++) {
-        totlen += E.row[j].size + 1;
+// this waits for all of the indexing threads and adds their blocks to the row store, in file order
+void editorIndexFinish(void) {
+    for (int j = 0; j < E.nindexjobs; j++) {
+        struct indexJob *job = &E.indexjobs[j];
+        if (job->done != 2) pthread_join(job->thread, NULL);
+        editorIndexAppend(job->blocks, job->nblocks, job->end);
     }
-    // we save the total length into buflen to tell the caller how long the string is
-    *buflen = totlen;
+    free(E.indexjobs);
+    E.indexjobs = NULL;
+    E.nindexjobs = 0;
+}
 
-    // we allocate the required memory
-    char *buf = malloc(totlen);
-    char *p = buf;
-    // then we loop through the rows and memcpy() the contents of each row to the end of the buffer, appending a newline character after each row
-    for (j = 0; j < E.numrows; j++) {
-        memcpy(p, E.row[j].chars, E.row[j].size);
-        p += E.row[j].size;
-        *p = '\n';
-        p++;
+// this checks whether the indexing threads are done without waiting for them, and if they are, adds their rows to the file and redraws the screen so the line count in the status bar is right
+void editorIndexPoll(void) {
+    int done = 1;
+    pthread_mutex_lock(&E.indexlock);
+    for (int j = 0; j < E.nindexjobs; j++) {
+        if (!E.indexjobs[j].done) done = 0;
     }
+    pthread_mutex_unlock(&E.indexlock);
+    if (!done) return;
+    editorIndexFinish();
+    E.redraw = 1;
+}
 
-    // lastly, we return buf, and we expect the caller to free() the memory
-    return buf;
+// this makes sure there are more than upto rows, or the whole file has been indexed. anything that needs rows further into the file than the first screen calls this first, and passing INT_MAX indexes the whole file. if the indexing threads haven't gotten that far yet, we wait for them
+void editorIndexRows(int upto) {
+    if (E.numrows <= upto && E.nindexjobs) editorIndexFinish();
 }
 
 // editorOpen() will eventually be for opening and reading a file from disk, so we put this in a new section
 void editorOpen(char *filename) {
+    // if a file was open before, its rows go first
+    editorFreeRows();
     free(E.filename);
     // strdup() makes a copy of the given string, allocating the required memory and assuming you will free() that memory
     E.filename = strdup(filename);
@@ -770,8 +3407,33 @@ void editorOpen(char *filename) {
     // we set the syntax highlighting here based on what kind of file was opened
     editorSelectSyntaxHighlight();
 
-    FILE *fp = fopen(filename, "r");
-    if (!fp) die ("fopen");
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) die("open");
+
+    // for regular files we map the file into memory instead of reading it in. only the first chunk of the file gets split into rows before the first screen is drawn, and the rows only point into the mapping, so opening a huge file takes no longer than opening a small one. the rest of the file is indexed while the editor is idle
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            // we keep the file descriptor open so that saving can copy the parts of the file that weren't changed straight from it
+            E.mapfd = fd;
+            E.map = map;
+            E.mapsize = st.st_size;
+            E.mapindexed = 0;
+            E.mapmtime = st.st_mtim;
+            // a file we've opened before might not need indexing at all
+            if (!editorCacheLoad(&st)) {
+                editorIndexMap(KILO_INDEX_CHUNK);
+                editorIndexStart();
+            }
+            E.dirty = 0;
+            return;
+        }
+    }
+
+    // files that can't be mapped, like pipes, are read in line by line instead
+    FILE *fp = fdopen(fd, "r");
+    if (!fp) die ("fdopen");
 
     char *line = NULL;
     size_t linecap = 0;
@@ -784,14 +3446,362 @@ void editorOpen(char *filename) {
         while (linelen > 0 && (line[linelen - 1] == '\n' || line[linelen - 1] == '\r')) {
             linelen--;
         }
-        editorInsertRow(E.numrows, line, linelen);
-        }
+        // the text of each line goes into the arena, one after another, so reading in a file takes a few big allocations instead of one for every line
+        char *chars = arenaAlloc(&E.rowarena, linelen);
+        memcpy(chars, line, linelen);
+        editorInsertRowChars(E.numrows, chars, linelen, ROW_ARENA);
+    }
     free(line);
     fclose(fp);
     E.dirty = 0; // editorOpen() calls editorAppendRow() which increments E.dirty, even without the user making any changes, so we want to reset E.dirty after opening the file ---- editorAppendRow() has been changed to editorInsertRow
 }
 
-// this function will actually write the string return by editorRowsToString() to the disk
+// this adds len bytes from p to the snapshot, copying them into its chunks. text that follows straight on from the last segment's text just makes that segment longer
+void editorSnapText(struct saveJob *job, const char *p, size_t len) {
+    if (len == 0) return;
+    if (job->nchunks == 0 || job->chunkused + len > job->chunksize) {
+        job->chunks = krealloc(job->chunks, sizeof(char *) * (job->nchunks + 1));
+        job->chunksize = len > KILO_SAVE_CHUNK ? len : KILO_SAVE_CHUNK;
+        job->chunks[job->nchunks] = kmalloc(job->chunksize);
+        if (job->chunks == NULL || job->chunks[job->nchunks] == NULL) die("malloc");
+        job->nchunks++;
+        job->chunkused = 0;
+    }
+    char *dst = &job->chunks[job->nchunks - 1][job->chunkused];
+    memcpy(dst, p, len);
+    job->chunkused += len;
+    struct saveSegment *last = job->nsegs ? &job->segs[job->nsegs - 1] : NULL;
+    if (last && last->text && last->text + last->len == dst) {
+        last->len += len;
+        return;
+    }
+    if (job->nsegs == job->segcap) {
+        job->segcap = job->segcap ? job->segcap * 2 : 64;
+        job->segs = krealloc(job->segs, sizeof(struct saveSegment) * job->segcap);
+        if (job->segs == NULL) die("realloc");
+    }
+    job->segs[job->nsegs].text = dst;
+    job->segs[job->nsegs].len = len;
+    job->nsegs++;
+}
+
+// this adds E.map[off..off + len) to the snapshot, without copying it. nothing ever writes to the mapping, so the writer can read it whenever it gets to it
+void editorSnapCopy(struct saveJob *job, size_t off, size_t len) {
+    struct saveSegment *last = job->nsegs ? &job->segs[job->nsegs - 1] : NULL;
+    if (last && !last->text && last->mapoff + last->len == off) {
+        last->len += len;
+        return;
+    }
+    if (job->nsegs == job->segcap) {
+        job->segcap = job->segcap ? job->segcap * 2 : 64;
+        job->segs = krealloc(job->segs, sizeof(struct saveSegment) * job->segcap);
+        if (job->segs == NULL) die("realloc");
+    }
+    job->segs[job->nsegs].text = NULL;
+    job->segs[job->nsegs].mapoff = off;
+    job->segs[job->nsegs].len = len;
+    job->nsegs++;
+}
+
+// this adds a line that's still in the mapping, and a newline after it. when the line ends the same way in the file, we can copy the line along with its newline. a line that ended with "\r\n", or was the last line of a file without a newline at the end, gets written out with just a '\n' instead, the same as any other row
+void editorSnapMapped(struct saveJob *job, const char *p, int len) {
+    size_t off = p - E.map;
+    if (off + len < E.mapsize && E.map[off + len] == '\n') {
+        editorSnapCopy(job, off, len + 1);
+    } else {
+        editorSnapText(job, p, len);
+        editorSnapText(job, "\n", 1);
+    }
+}
+
+// this takes a snapshot of every row of the file, with a newline after each one
+// // anything that's still exactly as it is in the memory-mapped file is only noted down, to be copied straight from the file on disk later, so the snapshot of a huge file costs about as much as the edits made to it
+void editorSnapRows(struct saveJob *job) {
+    // every row of the file has to be written out, so any part of a memory-mapped file that hasn't been indexed yet gets indexed now
+    editorIndexRows(INT_MAX);
+    for (int b = 0; b < E.nblocks; b++) {
+        struct rowBlock *block = E.blocks[b];
+        if (!block->rows) {
+            // a block that was never loaded hasn't been changed. if its lines all end in a plain '\n', the block is already exactly what we'd write, so the whole of it gets copied
+            char *p = &E.map[block->mapoff];
+            char *end = p + block->maplen;
+            if (block->maplen && end[-1] == '\n' && !memchr(p, '\r', block->maplen)) {
+                editorSnapCopy(job, block->mapoff, block->maplen);
+                continue;
+            }
+            for (int j = 0; j < block->nrows; j++) {
+                int len;
+                char *next = editorMapLine(p, end, &len);
+                editorSnapMapped(job, p, len);
+                p = next;
+            }
+            continue;
+        }
+        for (int j = 0; j < block->nrows; j++) {
+            erow *row = &block->rows[j];
+            if (row->flags & ROW_MAPPED) {
+                editorSnapMapped(job, row->chars, row->size);
+            } else {
+                // each row's text is split in two by its gap, so we copy the part before the gap and then the part after it
+                editorSnapText(job, row->chars, row->gap);
+                editorSnapText(job, &row->chars[row->gap + row->gaplen], row->size - row->gap);
+                editorSnapText(job, "\n", 1);
+            }
+        }
+    }
+}
+
+// the writer streams the snapshot out to the file through writev() a batch of segments at a time. runs of the mapping get copied from the file on disk with copy_file_range(), without passing through the editor at all. when the kernel or filesystem can't do that, copy_file_range() fails right away and we write the run out of the mapping instead
+// // writev() and write() can write fewer bytes than we asked them to, in which case we skip over what they did write and go again
+int editorSaveWriteText(int fd, struct iovec *iov, int n, long long *written) {
+    while (n > 0) {
+        ssize_t w = writev(fd, iov, n);
+        if (w == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        *written += w;
+        while (n > 0 && (size_t) w >= iov->iov_len) {
+            w -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *) iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    return 0;
+}
+
+int editorSaveWriteCopy(struct saveJob *job, int fd, size_t off, size_t len, long long *written) {
+    while (len > 0) {
+        off_t from = off;
+        ssize_t w = copy_file_range(job->mapfd, &from, fd, NULL, len, 0);
+        if (w <= 0) {
+            if (w == -1 && errno == EINTR) continue;
+            w = write(fd, &job->map[off], len);
+            if (w <= 0) {
+                if (w == -1 && errno == EINTR) continue;
+                return -1;
+            }
+        }
+        *written += w;
+        off += w;
+        len -= w;
+    }
+    return 0;
+}
+
+// this writes the snapshot to fd and returns how many bytes it wrote, or -1 if there was an error
+long long editorSaveWriteAll(struct saveJob *job, int fd) {
+    struct iovec iov[KILO_SAVE_IOV];
+    long long written = 0;
+    int i = 0;
+    while (i < job->nsegs) {
+        struct saveSegment *seg = &job->segs[i];
+        if (!seg->text) {
+            if (editorSaveWriteCopy(job, fd, seg->mapoff, seg->len, &written) == -1) return -1;
+            i++;
+            continue;
+        }
+        int n = 0;
+        while (i < job->nsegs && job->segs[i].text && n < KILO_SAVE_IOV) {
+            iov[n].iov_base = (void *) job->segs[i].text;
+            iov[n].iov_len = job->segs[i].len;
+            n++;
+            i++;
+        }
+        if (editorSaveWriteText(fd, iov, n, &written) == -1) return -1;
+    }
+    return written;
+}
+
+// a rename() only survives a crash once the directory it changed has made it to the disk as well, so after renaming the new file over the old one we fsync() the directory they're in
+int editorSyncDir(const char *path) {
+    const char *slash = strrchr(path, '/');
+    char *dir = slash ? strndup(path, slash == path ? 1 : (size_t) (slash - path)) : strdup(".");
+    int fd = open(dir, O_RDONLY);
+    free(dir);
+    if (fd == -1) return -1;
+    int r = fsync(fd);
+    close(fd);
+    return r;
+}
+
+// this copies the len bytes of the new version of the file from the temporary file from over the file at path, which is how a file with more than one name gets saved. it returns len, or -1 if there was an error
+long long editorSaveCopyBack(int from, const char *path, long long len) {
+    int to = open(path, O_WRONLY);
+    if (to == -1) return -1;
+    off_t in = 0;
+    while (in < len) {
+        ssize_t w = copy_file_range(from, &in, to, NULL, len - in, 0);
+        if (w > 0) continue;
+        if (w == -1 && errno == EINTR) continue;
+        // like editorSaveWriteCopy(), when the kernel can't copy between the files for us we do it by hand
+        char buf[65536];
+        ssize_t r = pread(from, buf, len - in < (off_t) sizeof(buf) ? (size_t) (len - in) : sizeof(buf), in);
+        if (r > 0) r = write(to, buf, r);
+        if (r <= 0) {
+            if (r == -1 && errno == EINTR) continue;
+            close(to);
+            return -1;
+        }
+        in += r;
+    }
+    // the new version might be shorter than the old one
+    int ok = ftruncate(to, len) != -1 && fsync(to) != -1;
+    if (close(to) == -1) ok = 0;
+    return ok ? len : -1;
+}
+
+// this is what the writer thread runs
+// // rather than overwriting the file in place, where a crash halfway through would leave it cut short, we write a new file next to it, make sure it's on the disk with fsync(), and then rename() it over the old one. a rename is atomic, so the file is always either all of the old version or all of the new one
+// // a memory-mapped file doesn't have to be unmapped either. the old file stays around for as long as it's mapped, even after the new one has taken its name, so the rows that point into it stay good
+// // a file with hard links is the exception. renaming a new file over one of its names would split that name off from the others, so instead the new version is copied back over the file once it's all been written out. a failure while writing the new version still leaves the file untouched, and if the copy back fails partway, the temporary file is kept, since it's then the only complete copy of the new version
+void *editorSaveThread(void *arg) {
+    struct saveJob *job = arg;
+    // if the file is a symbolic link, we replace the file it links to rather than the link itself
+    char *path = realpath(job->path, NULL);
+    if (path == NULL) path = strdup(job->path);
+    // the new file keeps the permissions of the one it replaces. for a file that doesn't exist yet we use 0644, as its the standard set of permissions for a text file that the owner wants to read and write to while only letting others read it
+    struct stat old;
+    int exists = stat(path, &old) == 0;
+    mode_t mode = exists ? (old.st_mode & 07777) : 0644;
+
+    // mkstemp() replaces the XXXXXX with characters that make the name unique and creates the file
+    size_t tmplen = strlen(path) + 16;
+    char *tmp = kmalloc(tmplen);
+    snprintf(tmp, tmplen, "%s.kilo-XXXXXX", path);
+    int fd = mkstemp(tmp);
+    long long len = -1;
+    int keep = 0;
+    if (fd != -1) {
+        // it keeps the old file's owner and group too. only root can give a file to another user, so when we can't keep the owner we still try to keep the group. the permissions go on after, since changing the owner can clear the set-user-ID and set-group-ID bits
+        if (exists && fchown(fd, old.st_uid, old.st_gid) == -1 && fchown(fd, (uid_t) -1, old.st_gid) == -1) {
+            // the new file stays ours, like a file we'd just created
+        }
+        if (fchmod(fd, mode) != -1) len = editorSaveWriteAll(job, fd);
+        if (len != -1 && fsync(fd) == -1) len = -1;
+        if (len != -1 && job->inplace) {
+            len = editorSaveCopyBack(fd, path, len);
+            keep = len == -1;
+        }
+        if (close(fd) == -1) len = -1;
+        if (len != -1 && !job->inplace && (rename(tmp, path) == -1 || editorSyncDir(path) == -1)) len = -1;
+        // if anything went wrong, the old file is untouched and we get rid of the new one. the temporary file is no use either once it's been copied back
+        int saved = errno;
+        if ((len == -1 && !keep) || (len != -1 && job->inplace)) unlink(tmp);
+        errno = saved;
+    }
+    job->err = errno;
+    free(tmp);
+    free(path);
+
+    pthread_mutex_lock(&E.savelock);
+    job->written = len;
+    job->done = 1;
+    pthread_mutex_unlock(&E.savelock);
+    if (job->threaded) editorWake();
+    return NULL;
+}
+
+// this waits for the writer to finish, tells the user how the save went, and frees the snapshot
+void editorSaveFinish(void) {
+    struct saveJob *job = E.savejob;
+    if (job->threaded) pthread_join(job->thread, NULL);
+    E.savejob = NULL;
+    if (job->written != -1) {
+        // after saving the file, it will no longer have any unsaved changes, so we reflect that by resetting E.dirty here. unless the user changed something while it was being written, in which case those changes still aren't saved
+        if (E.dirty == job->dirty) E.dirty = 0;
+        // undoing back to the text that was saved leaves nothing unsaved, whether or not it's been changed since
+        E.undo_saved = job->undo_at;
+        editorSetStatusMessage("%lld bytes written to disk", job->written);
+    } else {
+        // strerror() is like perror() but takes errno as an argument and returns the human-readable string for that error code so that we can make the error part of the status message displayed to the user
+        editorSetStatusMessage("Can't save! I/O error: %s", strerror(job->err));
+    }
+    for (int i = 0; i < job->nchunks; i++) free(job->chunks[i]);
+    free(job->chunks);
+    free(job->segs);
+    free(job->path);
+    free(job);
+}
+
+// this waits for the save being written out in the background, if there is one
+void editorSaveWait(void) {
+    if (E.savejob) editorSaveFinish();
+}
+
+// a file that gets written over, rather than replaced, changes under its mapping, and the rows that point into the mapping would change with it. so before that happens every one of them gets a copy of its own text, and the mapping goes away. this costs as much memory as the file is big, but it's only needed for files with hard links
+void editorMapRelease(void) {
+    if (!E.map) return;
+    // a save still being written might be copying out of the mapping
+    editorSaveWait();
+    editorIndexRows(INT_MAX);
+    for (int b = 0; b < E.nblocks; b++) {
+        struct rowBlock *block = E.blocks[b];
+        rowBlockLoad(block);
+        for (int j = 0; j < block->nrows; j++) {
+            if (block->rows[j].flags & ROW_MAPPED) editorRowDetach(&block->rows[j]);
+        }
+    }
+    munmap(E.map, E.mapsize);
+    close(E.mapfd);
+    E.map = NULL;
+    E.mapfd = -1;
+    E.mapsize = 0;
+    E.mapindexed = 0;
+}
+
+// this takes a snapshot of the file and hands it to a writer thread, so the user can keep typing while it's written out. if we can't start a thread, it gets written out right here instead
+void editorSaveStart(void) {
+    // only one save is written out at a time
+    editorSaveWait();
+    struct saveJob *job = kcalloc(1, sizeof(struct saveJob));
+    if (job == NULL) die("calloc");
+    job->path = strdup(E.filename);
+    job->dirty = E.dirty;
+    // the next edit can't be merged into the last record, or the text as it's saved would be in the middle of a record, where undo can't stop
+    job->undo_at = E.undo_cur;
+    E.undo_last = ULLONG_MAX;
+    struct stat st;
+    if (stat(E.filename, &st) == 0 && st.st_nlink > 1) {
+        job->inplace = 1;
+        editorMapRelease();
+    }
+    job->map = E.map;
+    job->mapfd = E.mapfd;
+    editorSnapRows(job);
+    E.savejob = job;
+    E.lastsave = time(NULL);
+    job->threaded = pthread_create(&job->thread, NULL, editorSaveThread, job) == 0;
+    if (!job->threaded) {
+        editorSaveThread(job);
+        editorSaveFinish();
+        return;
+    }
+    editorSetStatusMessage("Saving %s...", E.filename);
+}
+
+// this is called while the user isn't typing. it finishes a save once the writer is done with it, and starts an autosave when one is due
+void editorSavePoll(void) {
+    if (E.savejob) {
+        pthread_mutex_lock(&E.savelock);
+        int done = E.savejob->done;
+        pthread_mutex_unlock(&E.savelock);
+        if (done) {
+            editorSaveFinish();
+            E.redraw = 1;
+        }
+        return;
+    }
+    if (KILO_AUTOSAVE > 0 && E.dirty && E.filename && time(NULL) - E.lastsave >= KILO_AUTOSAVE) {
+        editorSaveStart();
+        E.redraw = 1;
+    }
+}
+
 void editorSave(void) {
     // if it's a new file, then E.filename will be NULL
     if (E.filename == NULL) {
@@ -804,107 +3814,511 @@ void editorSave(void) {
         // we set the syntax highlighting again here in case the file didn't have a name before, or it was changed in the editing process
         editorSelectSyntaxHighlight();
     }
+    editorSaveStart();
+}
 
-    int len;
-    char *buf = editorRowsToString(&len);
+/*** follow ***/
+
+// these have the kernel tell us when the file being followed changes, by making E.followq readable. without inotify or kqueue they don't do anything, and the event loop's timer is all we have to go on
+void editorFollowWatch(void) {
+#if defined(KILO_FOLLOW_INOTIFY)
+    if (E.followq == -1) E.followq = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (E.followq != -1) E.followwd = inotify_add_watch(E.followq, E.filename, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+#elif defined(KILO_FOLLOW_KQUEUE)
+    if (E.followq == -1) E.followq = kqueue();
+    if (E.followq != -1) {
+        struct kevent ev;
+        EV_SET(&ev, E.followfd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_RENAME | NOTE_DELETE, 0, NULL);
+        kevent(E.followq, &ev, 1, NULL, 0, NULL);
+    }
+#endif
+}
 
-    // we tell open to create a new file if one doesn't already exist, where we have to pass an extra argument containing the mode (permissions) for the new file, so here we use 0644 as iits the standard set of permissions for a text file that the owner wants to read and write to while only letting others read it
-    int fd = open(E.filename, O_RDWR  | O_CREAT, 0644);
-    // open() and ftruncate() both return -1 on error
-    if (fd != -1) {
-        // ftruncate() sets the file's size to a specified length. if its larger than that, it will cut off any data at the end of the file to make it fit that length. if the file is shorter, it will add 0 bytes to the end to make it that length
-        // the normal way to overwrite a file is to pass the O_TRUNC flag to open() which truncates the file completely, by making it an empty file before writing the new data into it.
-        // // by truncating the file ourselves to the same length as the data we're planing to write into it, we're making the whole overwriting operation a bit safer in case ftruncate() succceeds but write() fails. in that case the file would still contain most of the data it had before, as opposed to the case of truncating the file completely and then having write() fail, which would result in all of the data being lost
-        // // // more advanced editors will write to a new temporary file, and then rename that file to the actual file the user wants to overwrite, carefully checking for errors through the whole process.
-        if (ftruncate(fd, len) != -1) {
-            // we expect write() to return the number of bytes we told it to write
-            if (write(fd, buf, len) == len) {
-                close(fd);
-                free(buf);
-                E.dirty = 0; // after saving the file, it will no longer have any unsaved changes, so we reflect that by resetting E.dirty here
-                editorSetStatusMessage("%d bytes written to disk", len);
-                return;
+// a kqueue forgets about a file by itself when the file is closed, but an inotify watch has to be taken off
+void editorFollowUnwatch(void) {
+#if defined(KILO_FOLLOW_INOTIFY)
+    if (E.followwd != -1) inotify_rm_watch(E.followq, E.followwd);
+#endif
+    E.followwd = -1;
+}
+
+// this throws away what E.followq has to tell us. we don't need to know which file changed or how, since every file being followed gets checked on after it anyway
+void editorFollowDrain(void) {
+#if defined(KILO_FOLLOW_INOTIFY)
+    char buf[4096];
+    while (read(E.followq, buf, sizeof(buf)) > 0);
+#elif defined(KILO_FOLLOW_KQUEUE)
+    struct kevent evs[16];
+    struct timespec zero = {0, 0};
+    while (kevent(E.followq, NULL, 0, evs, 16, &zero) > 0);
+#endif
+}
+
+// this starts following the current buffer's file. the buffer has everything in the file up to now, so only what gets written to it after this is added on
+void editorFollowStart(void) {
+    if (E.filename == NULL) {
+        editorSetStatusMessage("There's no file to follow");
+        return;
+    }
+    int fd = open(E.filename, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        editorSetStatusMessage("Can't follow %s", E.filename);
+        if (fd != -1) close(fd);
+        return;
+    }
+    E.follow = 1;
+    E.followfd = fd;
+    E.nfollow++;
+    // a mapped file was in the buffer up to the end of its mapping. an empty file wasn't mapped, and a file we couldn't map was read all the way through
+    E.followoff = E.map ? (off_t) E.mapsize : E.numrows ? st.st_size : 0;
+    E.followpartial = E.map && E.map[E.mapsize - 1] != '\n';
+    // if the file has been saved over since the buffer's rows were read from it, the file now has a different inode to the one mapped, and the first check treats it like a rotated log
+    struct stat mst;
+    if (E.map && fstat(E.mapfd, &mst) == 0) st = mst;
+    E.followdev = st.st_dev;
+    E.followino = st.st_ino;
+    editorFollowWatch();
+    editorSetStatusMessage("Following %s", E.filename);
+}
+
+void editorFollowStop(void) {
+    if (!E.follow) return;
+    editorFollowUnwatch();
+    close(E.followfd);
+    E.follow = 0;
+    E.followfd = -1;
+    E.nfollow--;
+}
+
+// Ctrl-E starts and stops following the current buffer's file
+void editorFollowToggle(void) {
+    if (!E.follow) {
+        editorFollowStart();
+        return;
+    }
+    editorFollowStop();
+    editorSetStatusMessage("Stopped following %s", E.filename);
+}
+
+// this moves the cursor of every window on the current buffer to the new last row, if it was on the last row before old rows became more, so that a window that was looking at the end of the file keeps looking at the end of it. the window the cursor is in has its cursor in E, and the others have theirs in their editorWindow
+void editorFollowScroll(int old) {
+    int last = E.numrows ? E.numrows - 1 : 0;
+    for (int w = 0; w < E.nwindows; w++) {
+        struct editorWindow *win = &E.windows[w];
+        if (win->buf != E.curbuf) continue;
+        int *cy = w == E.curwin ? &E.cy : &win->cy;
+        int *cx = w == E.curwin ? &E.cx : &win->cx;
+        if (*cy >= old - 1) {
+            *cy = last;
+            *cx = 0;
+        }
+    }
+}
+
+// this adds len bytes that were appended to the file to the end of the buffer. the first of them carry on the last row if the file ended partway through a line, and the rest get split into rows all at once
+// // none of it is an edit, so it doesn't make the buffer dirty and doesn't go in the undo log. the undo log's rows and columns stay right, since the new text only ever goes after everything that's already there
+void editorFollowAppend(char *text, size_t len) {
+    int old = E.numrows;
+    int dirty = E.dirty;
+    size_t start = 0;
+    if (E.followpartial && E.numrows > 0) {
+        char *nl = memchr(text, '\n', len);
+        size_t end = nl ? (size_t) (nl - text) : len;
+        int n = end;
+        if (nl && n > 0 && text[n - 1] == '\r') n--;
+        E.undo_replay = 1;
+        erow *row = editorRowAt(E.numrows - 1);
+        editorRowInsert(row, row->size, text, n);
+        E.undo_replay = 0;
+        start = nl ? end + 1 : len;
+    }
+    E.numrows += rowStoreAppendText(text + start, len - start, ROW_ARENA);
+    E.followpartial = text[len - 1] != '\n';
+    E.dirty = dirty;
+    // the background highlighter works out the state the new rows end in. only the ones on the screen get highlighted before they're drawn
+    editorHlInvalidate(old, E.numrows);
+    editorFollowScroll(old);
+    E.redraw = 1;
+}
+
+// the file's name points at a new file, or the file got shorter, which is what happens to a log when it's rotated. if the buffer has no changes that would be lost, we read the file again from the start and keep following it. otherwise we stop
+void editorFollowReload(void) {
+    if (E.dirty) {
+        editorFollowStop();
+        editorSetStatusMessage("%s changed on disk, so it's no longer being followed", E.filename);
+        return;
+    }
+    char *filename = strdup(E.filename);
+    // editorOpen() puts the cursor at the top of the file, but the cursor in E belongs to the window it's in, which might be showing another buffer
+    int cx = E.cx, cy = E.cy, rx = E.rx, rowoff = E.rowoff, coloff = E.coloff;
+    editorOpen(filename);
+    E.cx = cx;
+    E.cy = cy;
+    E.rx = rx;
+    E.rowoff = rowoff;
+    E.coloff = coloff;
+    free(filename);
+    editorFollowStart();
+    // every window on the buffer starts again at the end of it
+    editorFollowScroll(0);
+    E.redraw = 1;
+}
+
+// this checks whether the current buffer's file has grown, and adds whatever was appended to it. the event loop calls it for every buffer that's following its file, whenever it wakes up
+void editorFollowPoll(void) {
+    // the rows still being indexed come before the new ones, so we wait for the indexing threads to finish first
+    if (E.nindexjobs) return;
+    struct stat st;
+    // a log that's been rotated away might not have been made again yet, so we just wait for it
+    if (stat(E.filename, &st) == -1) return;
+    if (st.st_dev != E.followdev || st.st_ino != E.followino || st.st_size < E.followoff) {
+        editorFollowReload();
+        return;
+    }
+    if (st.st_size == E.followoff) return;
+    size_t n = st.st_size - E.followoff;
+    if (n > KILO_FOLLOW_CHUNK) {
+        n = KILO_FOLLOW_CHUNK;
+        E.followbehind = 1;
+    }
+    // the new text goes into the buffer's arena, like the text of a file read in line by line, and the new rows point into it
+    char *text = arenaAlloc(&E.rowarena, n);
+    ssize_t got = pread(E.followfd, text, n, E.followoff);
+    if (got <= 0) return;
+    // a \r at the very end might be the first half of a \r\n, so we leave it for next time
+    if (text[got - 1] == '\r') got--;
+    if (got == 0) return;
+    E.followoff += got;
+    editorFollowAppend(text, got);
+}
+
+/*** find ***/
+
+// this looks for q in the len characters of text, starting at index from, and returns the index of the first match or -1 if there isn't one
+// // memchr() is vectorized in the C library, so we use it to skip straight to each place the first character of q appears, and only compare the rest of q there
+int editorFindIn(const char *text, int len, int from, const char *q, int qlen) {
+    if (qlen == 0) return from <= len ? from : -1;
+    while (from + qlen <= len) {
+        const char *p = memchr(&text[from], q[0], len - qlen + 1 - from);
+        if (!p) return -1;
+        int i = p - text;
+        if (!memcmp(&text[i + 1], &q[1], qlen - 1)) return i;
+        from = i + 1;
+    }
+    return -1;
+}
+
+// this gives us text the way it would be rendered. text without any tabs in it renders to exactly itself, so we only have to expand the tabs of the text that has them, which goes in buf
+const char *editorSearchExpand(const char *text, int size, char **buf, int *bufcap, int *len) {
+    if (!memchr(text, '\t', size)) {
+        *len = size;
+        return text;
+    }
+    int tabs = 0;
+    for (int j = 0; j < size; j++) if (text[j] == '\t') tabs++;
+    int needed = size + tabs * (KILO_TAB_STOP - 1);
+    if (needed > *bufcap) {
+        *bufcap = needed + needed / 2;
+        *buf = krealloc(*buf, (size_t) *bufcap + 1);
+        if (*buf == NULL) die("realloc");
+    }
+    // the tabs are expanded the same way editorUpdateRow() expands them, up to the next tab stop on the screen, so characters that aren't ASCII have to be decoded to know how many columns they take up
+    int idx = 0, col = 0;
+    for (int j = 0; j < size; j++) {
+        if (text[j] == '\t') {
+            do {
+                (*buf)[idx++] = ' ';
+                col++;
+            } while (col % KILO_TAB_STOP != 0);
+        } else if ((unsigned char) text[j] < 0x80) {
+            (*buf)[idx++] = text[j];
+            col++;
+        } else {
+            int cp, w;
+            int n = editorGlyph(&text[j], size - j, &cp, &w);
+            memcpy(&(*buf)[idx], &text[j], n);
+            idx += n;
+            j += n - 1;
+            col += w;
+        }
+    }
+    *len = idx;
+    return *buf;
+}
+
+// this gives us the text of a row the way the search sees it, which is its render. for rows that haven't been rendered yet we search the chars instead, with their tabs expanded, rather than rendering and highlighting the whole file. so do long rows, which only have a window of them rendered
+// // it doesn't change anything but the row itself, so the search threads can run it on different rows at the same time
+const char *editorRowSearchText(erow *row, char **buf, int *bufcap, int *len) {
+    if (row->render && !(row->flags & ROW_WINDOWED)) {
+        *len = row->rsize;
+        return row->render;
+    }
+    // a mapped row's chars are one contiguous run of the mapping, and an arena row's are one contiguous run of the arena. any other row's chars have a gap in them, so we move the gap out of the way to the end
+    if (!(row->flags & (ROW_MAPPED | ROW_ARENA))) editorRowMoveGap(row, row->size);
+    return editorSearchExpand(row->chars, row->size, buf, bufcap, len);
+}
+
+void editorSearchAddHit(struct searchHits *hits, int row, int col, int len) {
+    if (hits->n == hits->cap) {
+        hits->cap = hits->cap ? hits->cap * 2 : 64;
+        hits->v = krealloc(hits->v, sizeof(struct searchHit) * hits->cap);
+        if (hits->v == NULL) die("realloc");
+    }
+    hits->v[hits->n].row = row;
+    hits->v[hits->n].col = col;
+    hits->v[hits->n].len = len;
+    hits->n++;
+}
+
+// this adds every match of the level's query in the len characters of text, which is row at, to hits. re is the compiled regex to use when the query is a regex
+void editorSearchLine(struct searchLevel *l, regex_t *re, const char *text, int len, int at, struct searchHits *hits) {
+    if (!l->regex) {
+        int i = editorFindIn(text, len, 0, l->query, l->qlen);
+        while (i != -1) {
+            editorSearchAddHit(hits, at, i, l->qlen);
+            i = editorFindIn(text, len, i + 1, l->query, l->qlen);
+        }
+        return;
+    }
+    // REG_STARTEND has regexec() look only at text[rm_so..rm_eo) of the pmatch we pass it, so it doesn't need text to end in a null byte, and we can carry on from the end of the last match without copying anything
+    int from = 0;
+    while (from <= len) {
+        regmatch_t m;
+        m.rm_so = from;
+        m.rm_eo = len;
+        if (regexec(re, text, 1, &m, REG_STARTEND | (from ? REG_NOTBOL : 0)) != 0) break;
+        editorSearchAddHit(hits, at, m.rm_so, m.rm_eo - m.rm_so);
+        // a regex can match nothing at all, in which case we move on by a character so we don't find the same empty match forever
+        from = m.rm_eo > m.rm_so ? m.rm_eo : m.rm_so + 1;
+    }
+}
+
+// this searches the rows of a job, and is what each search thread runs
+// // a block of a memory-mapped file that hasn't been loaded yet is still just lines of the mapping, so we search those lines right where they are instead of building erows for them
+void *editorSearchThread(void *arg) {
+    struct searchJob *job = arg;
+    regex_t *re = job->l->regex ? &job->re : NULL;
+    int off;
+    int b = rowStoreFind(job->from, &off);
+    int at = job->from;
+    while (at < job->to) {
+        struct rowBlock *block = E.blocks[b++];
+        int len;
+        const char *text;
+        if (block->rows) {
+            for (; off < block->nrows && at < job->to; off++, at++) {
+                text = editorRowSearchText(&block->rows[off], &job->buf, &job->bufcap, &len);
+                editorSearchLine(job->l, re, text, len, at, &job->hits);
+            }
+        } else {
+            char *p = &E.map[block->mapoff];
+            char *end = p + block->maplen;
+            for (int j = 0; j < block->nrows && at < job->to; j++) {
+                int size;
+                char *next = editorMapLine(p, end, &size);
+                if (j >= off) {
+                    text = editorSearchExpand(p, size, &job->buf, &job->bufcap, &len);
+                    editorSearchLine(job->l, re, text, len, at, &job->hits);
+                    at++;
+                }
+                p = next;
             }
         }
-        // whether or not there was an errorm we still want to make sure we close the file and free the memory that buf points to
-        close(fd);
+        off = 0;
+    }
+    return NULL;
+}
+
+// this searches the rows from l->scanned up to to, split between as many threads as are worth starting, and adds their matches to the level in file order
+// // the main thread holds E.lock while it waits for them, so the background highlighter can't touch the rows while they're being searched
+void editorSearchScan(struct searchLevel *l, int to) {
+    int rows = to - l->scanned;
+    if (rows <= 0) return;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int n = cpus > 0 ? (int) cpus : 1;
+    if (n > KILO_SEARCH_THREADS) n = KILO_SEARCH_THREADS;
+    // we never give a thread fewer rows than its share of a batch, since starting a thread costs more than searching a few rows
+    if (n > rows / (KILO_SEARCH_BATCH / KILO_SEARCH_THREADS)) n = rows / (KILO_SEARCH_BATCH / KILO_SEARCH_THREADS);
+    if (n < 1) n = 1;
+
+    struct searchJob *jobs = kcalloc(n, sizeof(struct searchJob));
+    if (jobs == NULL) die("calloc");
+    int from = l->scanned;
+    for (int j = 0; j < n; j++) {
+        struct searchJob *job = &jobs[j];
+        job->l = l;
+        job->from = from;
+        job->to = (j == n - 1) ? to : l->scanned + (int) ((long) rows * (j + 1) / n);
+        from = job->to;
+        if (l->regex) job->compiled = regcomp(&job->re, l->query, REG_EXTENDED) == 0;
+        // the last job runs on the main thread, which would otherwise just be waiting. if we can't start a thread for any of the others, we do its work right here instead
+        job->threaded = j < n - 1 && pthread_create(&job->thread, NULL, editorSearchThread, job) == 0;
+        if (!job->threaded) editorSearchThread(job);
+    }
+    for (int j = 0; j < n; j++) {
+        struct searchJob *job = &jobs[j];
+        if (job->threaded) pthread_join(job->thread, NULL);
+        for (int i = 0; i < job->hits.n; i++) editorSearchAddHit(&l->hits, job->hits.v[i].row, job->hits.v[i].col, job->hits.v[i].len);
+        free(job->hits.v);
+        free(job->buf);
+        if (job->compiled) regfree(&job->re);
+    }
+    free(jobs);
+    l->scanned = to;
+}
+
+// this searches rows a batch at a time until the level has at least want hits, or until the whole file has been searched
+void editorSearchScanUntil(struct searchLevel *l, int want) {
+    while (l->hits.n < want && l->scanned < E.numrows) {
+        int to = E.numrows - l->scanned > KILO_SEARCH_BATCH ? l->scanned + KILO_SEARCH_BATCH : E.numrows;
+        editorSearchScan(l, to);
+    }
+}
+
+void editorSearchFreeLevel(struct searchLevel *l) {
+    free(l->query);
+    free(l->hits.v);
+    if (l->regex && !l->bad) regfree(&l->re);
+}
+
+// this frees all the levels of the search
+void editorSearchClear(void) {
+    for (int i = 0; i < E.nsearch; i++) editorSearchFreeLevel(&E.search[i]);
+    E.nsearch = 0;
+    E.search_current = -1;
+}
+
+// this returns the level for query, making it if we don't have it yet
+// // the levels we keep are for the queries the user typed on the way to the current one. the ones the new query doesn't start with are of no use anymore, so we drop them. if the query starts with the last level's query, every match of the new query is also a match of that one, so we only have to check that level's hits instead of searching the rows it's already searched
+// // that isn't true of a regex, so a regex level is only ever reused for the exact same regex
+struct searchLevel *editorSearchQuery(const char *query) {
+    int qlen = strlen(query);
+    while (E.nsearch) {
+        struct searchLevel *top = &E.search[E.nsearch - 1];
+        if (top->regex == E.search_regex && top->qlen <= qlen && !memcmp(top->query, query, top->qlen) && (!top->regex || top->qlen == qlen)) break;
+        editorSearchFreeLevel(top);
+        E.nsearch--;
+    }
+    if (E.nsearch && E.search[E.nsearch - 1].qlen == qlen) return &E.search[E.nsearch - 1];
+
+    if (E.nsearch == E.searchcap) {
+        E.searchcap = E.searchcap ? E.searchcap * 2 : 8;
+        E.search = krealloc(E.search, sizeof(struct searchLevel) * E.searchcap);
+        if (E.search == NULL) die("realloc");
+    }
+    struct searchLevel *l = &E.search[E.nsearch];
+    memset(l, 0, sizeof(*l));
+    l->query = strdup(query);
+    l->qlen = qlen;
+    l->regex = E.search_regex;
+    if (l->regex) {
+        // the regex gets compiled once here, and once more by each search thread, never once per row. a regex that doesn't compile is marked as already having searched the whole file, with no matches
+        if (regcomp(&l->re, query, REG_EXTENDED) != 0) {
+            l->bad = 1;
+            l->scanned = INT_MAX;
+        }
+    } else if (E.nsearch) {
+        struct searchLevel *prev = &E.search[E.nsearch - 1];
+        char *buf = NULL;
+        int bufcap = 0;
+        for (int i = 0; i < prev->hits.n; i++) {
+            struct searchHit *hit = &prev->hits.v[i];
+            int len;
+            const char *text = editorRowSearchText(editorRowAt(hit->row), &buf, &bufcap, &len);
+            if (editorMatchAt(text, len, hit->col, query, qlen)) editorSearchAddHit(&l->hits, hit->row, hit->col, qlen);
+        }
+        free(buf);
+        l->scanned = prev->scanned;
     }
-    free(buf);
-    // because of the return statement above, we only reach this point if there was an error in the process of saving the file
-    // // strerror() is like perror() but takes errno as an argument and returns the human-readable string for that error code so that we can make the error part of the status message displayed to the user
-    editorSetStatusMessage("Can't save! I/O error: %s", strerror(errno));
+    E.nsearch++;
+    return l;
 }
 
-/*** find ***/
+// this is called while the user isn't typing, and searches the rest of the file for the current query so we can show how many matches there are. it stops as soon as a key is pressed, and returns whether it searched anything
+int editorSearchStep(void) {
+    struct searchLevel *l = &E.search[E.nsearch - 1];
+    if (l->scanned >= E.numrows) return 0;
+    do {
+        int to = E.numrows - l->scanned > KILO_SEARCH_BATCH ? l->scanned + KILO_SEARCH_BATCH : E.numrows;
+        editorSearchScan(l, to);
+    } while (l->scanned < E.numrows && !editorInputPending());
+    return 1;
+}
 
 // in this callback, we check if the user pressed Enter or Escape, in which case they are leaving search mode so we return immediately instead of doing another search.
 void editorFindCallback(char *query, int key) {
-    // last match will contain the index of the row that the last match was on, or -1 if there was no last match
+    // last match will contain the index of the match the cursor was put on last in the hits of the query, or -1 if there was no last match
     static int last_match = -1;
     // direction will store the direction of the search, 1 for forwards and -1 for backwards
     static int direction = 1;
 
-    static int saved_hl_line;
-    // here we restore hl to the contents of saved_hl
-    static char *saved_hl = NULL; // save_hl is a dynamically allocated array which points to NULL when there is nothing to restore
+    // the match we drew last time isn't the one the cursor is on anymore
+    E.match_row = -1;
 
-    if (saved_hl) {
-        // if there is anything to restore, we memcpy() it to the saved line's hl and then deallocate saved_hl and set it back to NULL
-        memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
-        free(saved_hl);
-        saved_hl = NULL;
-    }
-    
     // we always reset last_match to -1 unless an arrow key was pressed, so we only advanced to the next or previous match when that happens. direction is also always set to 1 unless the left or up keys are pressed. so we always search forward unless the user specifies otherwise
     if (key == '\r' || key == '\x1b') {
         last_match = -1;
         direction = 1;
+        editorSearchClear();
         return;
     } else if (key == ARROW_RIGHT || key == ARROW_DOWN) {
         direction = 1;
     } else if (key == ARROW_LEFT || key == ARROW_UP) {
         direction = -1;
     } else {
+        // Ctrl-R switches between searching for the query as it is and as a regex, and starts the search over
+        if (key == CTRL_KEY('r')) E.search_regex = !E.search_regex;
         last_match = -1;
         direction = 1;
     }
 
     if (last_match == -1) direction = 1;
-    // current is the index of the current row we're searching. if there was a last match, it starts on the line before (if searching forwards) or after (searching backwards). if there wasn't a last match, it starts at the top of the file and searches forward to find the first match
-    int current = last_match;
-    // if the user hasn't pressed Enter or Escape, any key press starts another search for the current query string
-    int i;
-    // looping through all the rows of the file here
-    for (i = 0; i < E.numrows; i++) {
-        current += direction;
-        // this if-else-if statement causes current to go from the end of the file back to beginning, or from the begining to the end, to allow a search to "wrap around" the end of the file and continue from the top (or bottom)
-        if (current == -1) current = E.numrows - 1;
-        else if (current == E.numrows) current = 0;
-
-        erow *row = &E.row[current];
-        // we use strstr() to check if query is a substring of the current row. it returns a pointer to the matching substring if there is a match, and otherwise returns NULL
-        char *match = strstr(row->render, query);
-        if (match) {
-            // when we find a match we set last_match to current, so that if the user presses the arrow keys, the next search starts from that point
-            last_match = current;
-            E.cy = current;
-            // if there is a match, we take the pointer to the matching substring and convert it into an index that we can set E.cx to, by substracting the row->render pointer from the match pointer, since match is a pointer into the row->render string
-            // E.cx = match - row->render; // there is an issue here: E.cx is an index into chars, but we assigned it to a render index. if there are tabs to the left of the match, the cursor will be in the wrong position. we must convert the render index into a chars index before assigning it to E.cx
-            E.cx = editorRowRxToCx(row, match - row->render); // this will now convert the matched index to a chars index and assign it to E.cx;
-
-            // the last thing we do is set E.rowoff so that we're at the very bottom of the file, which will cause editorScroll() to scroll up at the next screen refresh so that the matching line will be at the very top of the screen. This will make it so the user doesn't have to look all over the screen to find where their cursor jumped or where the matching line is
-            E.rowoff = E.numrows;
-
-            // save_hl_line is another static variable we use to know which line's hl needs to be restored
-            saved_hl_line = current;
-            // here's we'll save the original contents of hl in a static variable named saved_hl
-            saved_hl = malloc(row->rsize);
-            memcpy(saved_hl, row->hl, row->rsize);
-            // we memset() the matched substring to HL_MATCH in our search code here. match - row->render is the index of the render of the match, so we use that as our index into hl
-            memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-            break;
-        }
+    // an empty query doesn't match anything
+    if (query[0] == '\0') {
+        editorSearchClear();
+        last_match = -1;
+        return;
+    }
+    // a search looks through the whole file, so we make sure all of a memory-mapped file has been indexed
+    editorIndexRows(INT_MAX);
+    struct searchLevel *l = editorSearchQuery(query);
+
+    // current is the index of the match we move to. if there was a last match, it's the one after (if searching forwards) or before (searching backwards). if there wasn't a last match, it's the first match in the file
+    // // we only search as far into the file as we need to find it. the rest of the file gets searched in the background by editorSearchStep()
+    int current = last_match + direction;
+    if (current < 0) {
+        // going back from the first match wraps around to the last match in the file, which we can only know once we've searched all of it
+        editorSearchScanUntil(l, INT_MAX);
+        current = l->hits.n - 1;
+    } else {
+        editorSearchScanUntil(l, current + 1);
+        // going forward from the last match wraps around to the first one
+        if (current >= l->hits.n) current = 0;
+    }
+    if (current >= l->hits.n) {
+        E.search_current = -1;
+        return;
     }
+
+    struct searchHit *hit = &l->hits.v[current];
+    // the match goes at the top of the screen, so the state it's drawn in has to be right even when it's far past where we were
+    editorHlSettle(hit->row);
+    erow *row = editorRowAt(hit->row);
+    // when we find a match we set last_match to current, so that if the user presses the arrow keys, the next search starts from that point
+    last_match = current;
+    E.search_current = current;
+    E.cy = hit->row;
+    // the match's index is an index into render, so we convert it into an index into chars before setting E.cx to it, since there can be tabs to the left of the match
+    E.cx = editorRowRxToCx(row, hit->col);
+
+    // the last thing we do is set E.rowoff so that we're at the very bottom of the file, which will cause editorScroll() to scroll up at the next screen refresh so that the matching line will be at the very top of the screen. This will make it so the user doesn't have to look all over the screen to find where their cursor jumped or where the matching line is
+    E.rowoff = E.numrows;
+
+    // rather than changing the row's hl to HL_MATCH, and having to save it to put it back afterwards, we have editorDrawRows() draw the match over it
+    E.match_row = hit->row;
+    E.match_col = hit->col;
+    E.match_len = hit->len;
 }
 
 // when the user types a search query and presses Enter, we'll loop through all the rows of the file, and if a row contains their query string, we'll move the cursor to the match
@@ -915,7 +4329,7 @@ void editorFind(void) {
     int saved_coloff = E.coloff;
     int saved_rowoff = E.rowoff;
 
-    char *query = editorPrompt("Search: %s (ESC/Arrows/Enter)", editorFindCallback);
+    char *query = editorPrompt("Search: %s (ESC/Arrows/Enter, Ctrl-R regex)", editorFindCallback);
     // if the user pressed Escape to cancel the input prompt, then editorPrompt() returns NULL, we cancel the search, and restore the cursor to where it was
     if (query){
         free(query);
@@ -929,6 +4343,296 @@ void editorFind(void) {
     
 }
 
+// Ctrl-G asks for a line number and moves the cursor to the start of that line, which is shown at the top of the screen the same way a match of a search is
+void editorGotoLine(void) {
+    char *line = editorPrompt("Go to line: %s (ESC to cancel)", NULL);
+    if (line == NULL) return;
+    int n = atoi(line);
+    free(line);
+    if (n < 1) n = 1;
+    // a line past what's been indexed so far has to wait for the indexing threads
+    editorIndexRows(n - 1);
+    if (n > E.numrows) n = E.numrows;
+    if (n < 1) return;
+    editorHlSettle(n - 1);
+    E.cy = n - 1;
+    E.cx = 0;
+    E.rowoff = E.numrows;
+}
+
+/*** windows ***/
+
+// a new buffer starts out empty, the same way initEditor() starts E out
+void editorBufferInit(struct editorBuffer *b) {
+    memset(b, 0, sizeof(*b));
+    b->mapfd = -1;
+    b->lastsave = time(NULL);
+    b->hl_frontier = INT_MAX;
+    b->undo_last = ULLONG_MAX;
+    b->followfd = -1;
+    b->followwd = -1;
+}
+
+// these move the state of the current buffer out of E into its editorBuffer, and back into E from it
+void editorBufferStash(struct editorBuffer *b) {
+    b->numrows = E.numrows;
+    b->blocks = E.blocks;
+    b->nblocks = E.nblocks;
+    b->blockcap = E.blockcap;
+    b->blocktree = E.blocktree;
+    b->map = E.map;
+    b->mapfd = E.mapfd;
+    b->mapsize = E.mapsize;
+    b->mapindexed = E.mapindexed;
+    b->mapmtime = E.mapmtime;
+    b->rowarena = E.rowarena;
+    b->indexjobs = E.indexjobs;
+    b->nindexjobs = E.nindexjobs;
+    b->savejob = E.savejob;
+    b->lastsave = E.lastsave;
+    b->hl_frontier = E.hl_frontier;
+    b->hl_until = E.hl_until;
+    b->dirty = E.dirty;
+    b->filename = E.filename;
+    b->syntax = E.syntax;
+    b->highlighter = E.highlighter;
+    b->undo = E.undo;
+    b->undo_tail = E.undo_tail;
+    b->undo_cur = E.undo_cur;
+    b->undo_head = E.undo_head;
+    b->undo_last = E.undo_last;
+    b->undo_saved = E.undo_saved;
+    b->undo_lasttyping = E.undo_lasttyping;
+    b->follow = E.follow;
+    b->followfd = E.followfd;
+    b->followwd = E.followwd;
+    b->followoff = E.followoff;
+    b->followdev = E.followdev;
+    b->followino = E.followino;
+    b->followpartial = E.followpartial;
+}
+void editorBufferLoad(struct editorBuffer *b) {
+    E.numrows = b->numrows;
+    E.blocks = b->blocks;
+    E.nblocks = b->nblocks;
+    E.blockcap = b->blockcap;
+    E.blocktree = b->blocktree;
+    E.map = b->map;
+    E.mapfd = b->mapfd;
+    E.mapsize = b->mapsize;
+    E.mapindexed = b->mapindexed;
+    E.mapmtime = b->mapmtime;
+    E.rowarena = b->rowarena;
+    E.indexjobs = b->indexjobs;
+    E.nindexjobs = b->nindexjobs;
+    E.savejob = b->savejob;
+    E.lastsave = b->lastsave;
+    E.hl_frontier = b->hl_frontier;
+    E.hl_until = b->hl_until;
+    E.dirty = b->dirty;
+    E.filename = b->filename;
+    E.syntax = b->syntax;
+    E.highlighter = b->highlighter;
+    E.undo = b->undo;
+    E.undo_tail = b->undo_tail;
+    E.undo_cur = b->undo_cur;
+    E.undo_head = b->undo_head;
+    E.undo_last = b->undo_last;
+    E.undo_saved = b->undo_saved;
+    E.undo_lasttyping = b->undo_lasttyping;
+    E.follow = b->follow;
+    E.followfd = b->followfd;
+    E.followwd = b->followwd;
+    E.followoff = b->followoff;
+    E.followdev = b->followdev;
+    E.followino = b->followino;
+    E.followpartial = b->followpartial;
+}
+
+// this makes buffer b the current one, without changing which window the cursor is in. the background highlighter only works on the current buffer, so we let it know it might have something to do now
+void editorBufferSwitch(int b) {
+    if (b == E.curbuf) return;
+    editorBufferStash(&E.buffers[E.curbuf]);
+    editorBufferLoad(&E.buffers[b]);
+    E.curbuf = b;
+    pthread_cond_signal(&E.hlcond);
+}
+
+// this runs fn once for each buffer, with each one made the current buffer in turn, and then makes the current buffer current again. it's for the things every buffer needs whether it's current or not, like finding out that its indexing or its save has finished
+void editorEachBuffer(void (*fn)(void)) {
+    int cur = E.curbuf;
+    for (int b = 0; b < E.nbuffers; b++) {
+        editorBufferSwitch(b);
+        fn();
+    }
+    editorBufferSwitch(cur);
+}
+
+// this is what the event loop checks on in each buffer
+void editorBufferPoll(void) {
+    if (E.nindexjobs) editorIndexPoll();
+    if (E.follow) editorFollowPoll();
+    // this is also where we find out that a save has finished, and start an autosave when one is due
+    editorSavePoll();
+}
+
+// this tells us whether any of the buffers has changes that haven't been saved
+int editorAnyDirty(void) {
+    if (E.dirty) return 1;
+    for (int b = 0; b < E.nbuffers; b++) {
+        if (b != E.curbuf && E.buffers[b].dirty) return 1;
+    }
+    return 0;
+}
+
+// these move the state of the window the cursor is in out of E into its editorWindow, and back into E from it
+void editorWindowStash(struct editorWindow *w) {
+    w->cx = E.cx;
+    w->cy = E.cy;
+    w->rx = E.rx;
+    w->rowoff = E.rowoff;
+    w->coloff = E.coloff;
+    w->top = E.screentop;
+    w->rows = E.screenrows;
+    w->frame_rowoff = E.frame_rowoff;
+    w->frame_coloff = E.frame_coloff;
+}
+void editorWindowLoad(struct editorWindow *w) {
+    E.rx = w->rx;
+    E.rowoff = w->rowoff;
+    E.coloff = w->coloff;
+    E.screentop = w->top;
+    E.screenrows = w->rows;
+    E.frame_rowoff = w->frame_rowoff;
+    E.frame_coloff = w->frame_coloff;
+    // the buffer might have changed in another window since this one last looked at it, so the cursor is moved back inside the file if it has to be
+    editorIndexRows(w->cy);
+    editorSetCursor(w->cy, w->cx);
+}
+
+// this makes w the window E works on, which brings the buffer it shows in along with it
+void editorWindowSwitch(int w) {
+    if (w == E.curwin) return;
+    editorWindowStash(&E.windows[E.curwin]);
+    E.curwin = w;
+    editorBufferSwitch(E.windows[w].buf);
+    editorWindowLoad(&E.windows[w]);
+}
+
+// this tells us whether row at of the current buffer is on the screen, in the window the cursor is in or in any other window on the same buffer. the background highlighter asks for a redraw when it changes a row this says yes to
+int editorRowOnScreen(int at) {
+    // the background highlighter also works on buffers that aren't shown in the window the cursor is in
+    if (E.windows[E.curwin].buf == E.curbuf && at >= E.rowoff && at < E.rowoff + E.screenrows) return 1;
+    for (int w = 0; w < E.nwindows; w++) {
+        struct editorWindow *win = &E.windows[w];
+        if (w != E.curwin && win->buf == E.curbuf && at >= win->rowoff && at < win->rowoff + win->rows) return 1;
+    }
+    return 0;
+}
+
+// this shares the lines of the terminal out between the windows, from the top down. each one gets the same number of lines, its status bar included, and the last one also gets whatever is left over. the message bar keeps the last line of the terminal
+void editorLayout(void) {
+    editorWindowStash(&E.windows[E.curwin]);
+    int lines = E.termrows - 1;
+    int share = lines / E.nwindows;
+    int top = 0;
+    for (int w = 0; w < E.nwindows; w++) {
+        int height = w == E.nwindows - 1 ? lines - top : share;
+        E.windows[w].top = top;
+        E.windows[w].rows = height > 1 ? height - 1 : 0;
+        top += height;
+    }
+    editorWindowLoad(&E.windows[E.curwin]);
+    // the windows have moved, so the lines in the frame no longer belong to the windows that will be drawn on them
+    E.frame_valid = 0;
+    E.redraw = 1;
+}
+
+// this splits the window the cursor is in into two windows on the same buffer, one above the other, and puts the cursor in the bottom one. the new window is only a cursor and a scroll position, since it shares everything else with the window it was split from
+void editorSplitWindow(void) {
+    if ((E.termrows - 1) / (E.nwindows + 1) < 2) {
+        editorSetStatusMessage("There's no room for another window");
+        return;
+    }
+    editorWindowStash(&E.windows[E.curwin]);
+    E.windows = krealloc(E.windows, sizeof(struct editorWindow) * (E.nwindows + 1));
+    int w = E.curwin + 1;
+    memmove(&E.windows[w + 1], &E.windows[w], sizeof(struct editorWindow) * (E.nwindows - w));
+    E.windows[w] = E.windows[E.curwin];
+    E.nwindows++;
+    // E already holds the new window's state, since it's a copy of the old one
+    E.curwin = w;
+    editorLayout();
+}
+
+// this closes the window the cursor is in, unless it's the only one, and moves the cursor into the window above it. the buffer it showed stays open
+void editorCloseWindow(void) {
+    if (E.nwindows == 1) {
+        editorSetStatusMessage("The last window can't be closed");
+        return;
+    }
+    int w = E.curwin;
+    memmove(&E.windows[w], &E.windows[w + 1], sizeof(struct editorWindow) * (E.nwindows - w - 1));
+    E.nwindows--;
+    E.curwin = w > 0 ? w - 1 : 0;
+    editorBufferSwitch(E.windows[E.curwin].buf);
+    editorWindowLoad(&E.windows[E.curwin]);
+    editorLayout();
+}
+
+// this shows buffer b in the window the cursor is in, from the top of the file
+void editorShowBuffer(int b) {
+    editorBufferSwitch(b);
+    E.windows[E.curwin].buf = b;
+    E.cx = E.cy = E.rx = 0;
+    E.rowoff = E.coloff = 0;
+}
+
+// this shows the next buffer, in the order they were opened, in the window the cursor is in
+void editorNextBuffer(void) {
+    if (E.nbuffers == 1) {
+        editorSetStatusMessage("There's no other buffer open");
+        return;
+    }
+    editorShowBuffer((E.curbuf + 1) % E.nbuffers);
+    editorSetStatusMessage("%s", E.filename ? E.filename : "[No Name]");
+}
+
+// this opens filename in a buffer of its own, and shows it in the window the cursor is in. a file that's already open just gets its buffer shown, and an empty buffer that never had a file in it gets the file opened in it instead of a new buffer
+void editorOpenBuffer(char *filename) {
+    // the current buffer's filename is in E, and the others' are in their editorBuffers
+    editorBufferStash(&E.buffers[E.curbuf]);
+    for (int b = 0; b < E.nbuffers; b++) {
+        if (E.buffers[b].filename && strcmp(E.buffers[b].filename, filename) == 0) {
+            editorShowBuffer(b);
+            return;
+        }
+    }
+    // editorOpen() gives up on the whole editor when it can't open the file, which is what we want for the first file named on the command line, but not for one opened while we're editing others
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        editorSetStatusMessage("Can't open %s: %s", filename, strerror(errno));
+        return;
+    }
+    close(fd);
+    if (!E.filename && E.numrows == 0 && !E.dirty) {
+        editorOpen(filename);
+        return;
+    }
+    E.buffers = krealloc(E.buffers, sizeof(struct editorBuffer) * (E.nbuffers + 1));
+    editorBufferInit(&E.buffers[E.nbuffers]);
+    E.nbuffers++;
+    editorShowBuffer(E.nbuffers - 1);
+    editorOpen(filename);
+}
+
+void editorOpenPrompt(void) {
+    char *filename = editorPrompt("Open: %s (ESC to cancel)", NULL);
+    if (filename == NULL) return;
+    editorOpenBuffer(filename);
+    free(filename);
+}
+
 /*** append buffer ***/
 
 // rather than make many calls to write() for the many lines of the terminal window, we want to add a line buffer to the tildes and write them all at once when the window is refreshed
@@ -936,24 +4640,34 @@ void editorFind(void) {
 struct abuf {
     char *b;
     int len;
+    int cap; // how many bytes b has room for
 };
 
 // this constant represents an empty buffer and acts as a constructor for our abuf type
-#define ABUF_INIT {NULL, 0}
+#define ABUF_INIT {NULL, 0, 0}
 
 void abAppend(struct abuf *ab, const char *s, int len) {
     // we have to allocate enough memory to hold the new string resulting from appending string s to a buf
-    // we have realloc() give us a block of memory the size of the current string plus the size of the string we're appending
+    // rather than growing the buffer by exactly len every time, we at least double its size whenever it runs out of room, so appending n bytes one at a time only reallocs about log n times
     // realloc() will either extend the size of the block of memory we have allocated, or it will free() the current block of memory and allocate a new block of memory somewhere else big enough for our new string
-    char *new = realloc(ab->b, ab->len + len);
-
-    if (new == NULL) return;
-    // we use memcpy() to copy the string s after the end of the current data in the buffer, and we update the pointer and length of the abuf to the new values
-    memcpy(&new[ab->len], s, len);
-    ab->b = new;
+    if (ab->len + len > ab->cap) {
+        int cap = ab->cap ? ab->cap * 2 : 4096;
+        while (cap < ab->len + len) cap *= 2;
+        char *new = krealloc(ab->b, cap);
+        if (new == NULL) return;
+        ab->b = new;
+        ab->cap = cap;
+    }
+    // we use memcpy() to copy the string s after the end of the current data in the buffer, and we update the length of the abuf to the new value
+    memcpy(&ab->b[ab->len], s, len);
     ab->len += len;
 }
 
+// this empties an abuf but keeps its memory around, so the next time it's filled it doesn't have to allocate anything
+void abReset(struct abuf *ab) {
+    ab->len = 0;
+}
+
 // this function is a destructor that deallocates the dynamic memory used by an abuf
 void abFree(struct abuf *ab) {
     free(ab->b);
@@ -961,10 +4675,58 @@ void abFree(struct abuf *ab) {
 
 /*** output ***/
 
+// the escape sequence that switches to the color of each editorHighlight value, worked out once when the editor starts, since the render loop would otherwise have to snprintf() one at every color change
+struct editorSgr {
+    char seq[8];
+    int len;
+};
+
+struct editorSgr HL_sgr[HL_COUNT];
+
+void editorInitSgr(void) {
+    for (int hl = 0; hl < HL_COUNT; hl++) {
+        struct editorSgr *sgr = &HL_sgr[hl];
+        // <esc>[39m switches back to the default text color
+        if (hl == HL_NORMAL) sgr->len = snprintf(sgr->seq, sizeof(sgr->seq), "\x1b[39m");
+        else sgr->len = snprintf(sgr->seq, sizeof(sgr->seq), "\x1b[%dm", editorSyntaxToColor(hl));
+    }
+}
+
+// this writes n out in decimal to buf, without a terminating null byte, and returns how many digits it wrote
+int editorItoa(char *buf, int n) {
+    char digits[12];
+    int len = 0;
+    unsigned int u = n < 0 ? 0 : n;
+    // we get the digits from last to first, then reverse them into buf
+    do {
+        digits[len++] = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    for (int i = 0; i < len; i++) buf[i] = digits[len - 1 - i];
+    return len;
+}
+
+// this appends the <esc>[row;colH escape sequence, which moves the cursor to the given row and column (both 1-indexed)
+void abAppendCursor(struct abuf *ab, int row, int col) {
+    char buf[32];
+    int len = 0;
+    buf[len++] = '\x1b';
+    buf[len++] = '[';
+    len += editorItoa(&buf[len], row);
+    buf[len++] = ';';
+    len += editorItoa(&buf[len], col);
+    buf[len++] = 'H';
+    abAppend(ab, buf, len);
+}
+
 void editorScroll(void) {
+    // we make sure there are enough rows indexed to fill the screen
+    editorIndexRows(E.rowoff + E.screenrows);
     E.rx = 0;
     if (E.cy < E.numrows) {
-        E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+        // E.rx is the column of the screen the cursor is on, which is its index into render unless the row has characters in it that take up more or less than one column
+        erow *row = editorRowAt(E.cy);
+        E.rx = editorRowCxToCol(row, E.cx);
     }
 
     if (E.cy < E.rowoff) {
@@ -981,159 +4743,393 @@ void editorScroll(void) {
     }
 }
 
+// this makes sure the frame is the size of the terminal. a frame of a different size can't tell us anything about what's on the screen, so a new one starts out invalid
+void editorFrameResize(void) {
+    int rows = E.termrows, cols = E.screencols;
+    if (E.frame_chars && rows == E.frame_rows && cols == E.frame_cols) return;
+    free(E.frame_chars);
+    free(E.frame_attrs);
+    free(E.line_chars);
+    free(E.line_attrs);
+    E.frame_chars = kmalloc(sizeof(ecell) * ((size_t) rows * cols + 1));
+    E.frame_attrs = kmalloc((size_t) rows * cols + 1);
+    E.line_chars = kmalloc(sizeof(ecell) * (cols + 1));
+    E.line_attrs = kmalloc(cols + 1);
+    if (!E.frame_chars || !E.frame_attrs || !E.line_chars || !E.line_attrs) die("malloc");
+    E.frame_rows = rows;
+    E.frame_cols = cols;
+    E.frame_valid = 0;
+}
+
+// this starts drawing a new line, which is blank until something is put in it
+void editorLineClear(void) {
+    for (int j = 0; j < E.frame_cols; j++) E.line_chars[j] = ' ';
+    memset(E.line_attrs, 0, E.frame_cols);
+}
+
+// this puts the len bytes of one character that takes up w columns into the line at column x, and returns the column after it
+// // a wide character takes up two cells, the second of which only says it's covered by the first. a wide character that would stick out past the right edge of the line gets a space instead. a character with no width, like a combining accent, goes in the same cell as the character before it, as long as there's room left in the cell
+int editorLinePutChar(int x, const char *s, int len, int w, int attr) {
+    ecell cell = 0;
+    if (w == 0) {
+        if (x == 0) return x;
+        int base = x - 1;
+        if (E.line_chars[base] == KILO_CELL_COMPLEX && base > 0) base--;
+        ecell old = E.line_chars[base] & ~KILO_CELL_COMPLEX;
+        int used = 0;
+        while (used < 7 && ((old >> (8 * used)) & 0xFF)) used++;
+        if (used + len > 7) return x;
+        for (int j = 0; j < len; j++) old |= (ecell) (unsigned char) s[j] << (8 * (used + j));
+        E.line_chars[base] = old | KILO_CELL_COMPLEX;
+        return x;
+    }
+    if (x + w > E.frame_cols) {
+        if (x < E.frame_cols) {
+            E.line_chars[x] = ' ';
+            E.line_attrs[x] = attr;
+        }
+        return E.frame_cols;
+    }
+    for (int j = 0; j < len; j++) cell |= (ecell) (unsigned char) s[j] << (8 * j);
+    if (w == 2) {
+        E.line_chars[x] = cell | KILO_CELL_COMPLEX;
+        E.line_attrs[x] = attr;
+        E.line_chars[x + 1] = KILO_CELL_COMPLEX;
+        E.line_attrs[x + 1] = attr;
+        return x + 2;
+    }
+    E.line_chars[x] = cell;
+    E.line_attrs[x] = attr;
+    return x + 1;
+}
+
+// this puts len bytes of s into the line being drawn, starting at column x, all with the same attribute. s is UTF-8, so a file name with characters that aren't ASCII in it takes up as many columns as it should. bytes that aren't valid UTF-8 become '?'
+void editorLinePut(int x, const char *s, int len, int attr) {
+    int i = 0;
+    while (i < len && x < E.frame_cols) {
+        unsigned char c = s[i];
+        if (c < 0x80) {
+            E.line_chars[x] = c;
+            E.line_attrs[x] = attr;
+            x++;
+            i++;
+            continue;
+        }
+        int cp, w;
+        int n = editorGlyph(&s[i], len - i, &cp, &w);
+        if (editorCharIsControl(cp)) x = editorLinePutChar(x, "?", 1, 1, attr);
+        else x = editorLinePutChar(x, &s[i], n, w, attr);
+        i += n;
+    }
+}
+
+// this appends the UTF-8 bytes of n cells. the second cell of a wide character doesn't have any
+void abAppendCells(struct abuf *ab, const ecell *cells, int n) {
+    char buf[256];
+    int j = 0;
+    while (j < n) {
+        int len = 0;
+        while (j < n && len + 7 <= (int) sizeof(buf)) {
+            ecell c = cells[j++];
+            if (c < 0x80) {
+                buf[len++] = c;
+                continue;
+            }
+            for (int k = 0; k < 7 && ((c >> (8 * k)) & 0xFF); k++) buf[len++] = (c >> (8 * k)) & 0xFF;
+        }
+        abAppend(ab, buf, len);
+    }
+}
+
+// this writes the escape sequences that switch the terminal from the attribute it's drawing with to attr
+void editorEmitAttr(struct abuf *ab, int attr) {
+    if (attr == E.frame_attr) return;
+    // <esc>[m is the only way to turn off inverted colors, but it also turns off the color, so we then set the color again
+    if ((E.frame_attr & KILO_ATTR_INVERSE) && !(attr & KILO_ATTR_INVERSE)) {
+        abAppend(ab, "\x1b[m", 3);
+        E.frame_attr = 0;
+    }
+    if ((attr & KILO_ATTR_INVERSE) && !(E.frame_attr & KILO_ATTR_INVERSE)) abAppend(ab, "\x1b[7m", 4);
+    int hl = attr & ~KILO_ATTR_INVERSE;
+    if (hl != (E.frame_attr & ~KILO_ATTR_INVERSE)) abAppend(ab, HL_sgr[hl].seq, HL_sgr[hl].len);
+    E.frame_attr = attr;
+}
+
+// this compares the line we just drew with line y of the frame, and writes out only the part of it that changed. then the line gets copied into the frame
+void editorDrawLine(struct abuf *ab, int y) {
+    int cols = E.frame_cols;
+    ecell *oc = &E.frame_chars[y * cols], *nc = E.line_chars;
+    unsigned char *oa = &E.frame_attrs[y * cols], *na = E.line_attrs;
+    int first = 0, last = cols - 1;
+    if (E.frame_valid) {
+        while (first < cols && nc[first] == oc[first] && na[first] == oa[first]) first++;
+        // the line hasn't changed, so there's nothing to write
+        if (first == cols) return;
+        while (last > first && nc[last] == oc[last] && na[last] == oa[last]) last--;
+    }
+    // the part of the line after end is blank, which we can clear all at once with <esc>[K instead of writing out spaces
+    int end = cols;
+    while (end > first && nc[end - 1] == ' ' && na[end - 1] == 0) end--;
+
+    // each cell is one column of the screen, so we can start writing at any cell, as long as the terminal and we agree on how wide each character is. for wide characters and combining marks, terminals don't always agree with us or with each other, so we redraw the whole line if there is one in it now, or was one in it before
+    int whole = !E.frame_valid;
+    for (int j = 0; j < cols && !whole; j++) {
+        if ((nc[j] | oc[j]) & KILO_CELL_COMPLEX) whole = 1;
+    }
+    if (whole) {
+        first = 0;
+        last = cols - 1;
+        end = cols;
+        while (end > 0 && nc[end - 1] == ' ' && na[end - 1] == 0) end--;
+    }
+
+    // the H command moves the cursor to the row and column we start writing at
+    abAppendCursor(ab, y + 1, first + 1);
+    int stop = last + 1 < end ? last + 1 : end;
+    // we write out each run of characters that share an attribute all at once
+    int j = first;
+    while (j < stop) {
+        int run = j + 1;
+        while (run < stop && na[run] == na[j]) run++;
+        editorEmitAttr(ab, na[j]);
+        abAppendCells(ab, &nc[j], run - j);
+        j = run;
+    }
+    if (last + 1 > end || whole) {
+        // <esc>[K clears the rest of the line with the attribute the terminal is drawing with, so we switch back to the default one first
+        editorEmitAttr(ab, 0);
+        abAppend(ab, "\x1b[K", 3);
+    }
+    memcpy(oc, nc, sizeof(ecell) * cols);
+    memcpy(oa, na, cols);
+}
+
+// when the file scrolls by fewer lines than the screen has, we have the terminal move the lines that are still on the screen, rather than drawing them all again
+// // <esc>[top;bottomr sets the scroll region to the rows the text is on, so the status and message bars stay put. <esc>[nS scrolls the region up n lines and <esc>[nT scrolls it down, and <esc>[r sets the scroll region back to the whole screen
+void editorScrollFrame(struct abuf *ab) {
+    int shift = E.rowoff - E.frame_rowoff;
+    int n = shift < 0 ? -shift : shift;
+    if (!E.frame_valid || shift == 0 || E.coloff != E.frame_coloff || n >= E.screenrows) return;
+
+    // the scroll region is just the lines of the window being drawn, so the other windows stay put too
+    char buf[48];
+    int blen = snprintf(buf, sizeof(buf), "\x1b[%d;%dr\x1b[%d%c\x1b[r", E.screentop + 1, E.screentop + E.screenrows, n, shift > 0 ? 'S' : 'T');
+    abAppend(ab, buf, blen);
+
+    // then we move the lines of the frame the same way, and blank out the ones the terminal scrolled in
+    int cols = E.frame_cols, keep = E.screenrows - n;
+    int from = E.screentop + (shift > 0 ? n : 0), to = E.screentop + (shift > 0 ? 0 : n), blank = E.screentop + (shift > 0 ? keep : 0);
+    memmove(&E.frame_chars[to * cols], &E.frame_chars[from * cols], sizeof(ecell) * keep * cols);
+    memmove(&E.frame_attrs[to * cols], &E.frame_attrs[from * cols], (size_t) keep * cols);
+    for (int j = blank * cols; j < (blank + n) * cols; j++) E.frame_chars[j] = ' ';
+    memset(&E.frame_attrs[blank * cols], 0, (size_t) n * cols);
+}
+
+// this draws a row that has characters in it that aren't ASCII into the line. we decode it from the start of render, since we only know which character is at E.coloff by adding up the widths of the ones before it
+// // the match the cursor is on is found by its bytes of render here, rather than by its columns on the screen
+void editorDrawRowUtf8(erow *row, int filerow) {
+    int match_from = INT_MAX, match_to = INT_MAX;
+    if (filerow == E.match_row) {
+        match_from = E.match_col - row->rbase;
+        match_to = match_from + E.match_len;
+    }
+    int current_hl = HL_NORMAL;
+    int col = row->cbase, i = 0;
+    while (i < row->rsize && col < E.coloff + E.screencols) {
+        int cp, w;
+        int n = editorGlyph(&row->render[i], row->rsize - i, &cp, &w);
+        int x = col - E.coloff;
+        if (editorCharIsControl(cp) || cp == -1) {
+            // like in a row that's all ASCII, control characters are drawn as a printable character with inverted colors. so are bytes that aren't valid UTF-8
+            char ch = (cp >= 0 && cp <= 26) ? '@' + cp : '?';
+            if (x >= 0) editorLinePutChar(x, &ch, 1, 1, KILO_ATTR_INVERSE | current_hl);
+        } else {
+            current_hl = (i >= match_from && i < match_to) ? HL_MATCH : row->hl[i];
+            if (x >= 0) editorLinePutChar(x, &row->render[i], n, w, current_hl);
+            // a wide character that's cut in half by the left edge of the screen leaves a space in the column that can be seen
+            else if (x + w > 0) editorLinePutChar(0, " ", 1, 1, current_hl);
+        }
+        col += w;
+        i += n;
+    }
+}
+
 void editorDrawRows(struct abuf *ab) {
     int y;
     // this prints out tildes at the beginning of each row
     for (y = 0; y < E.screenrows; y++) {
+        editorLineClear();
         // this outer if-statement checks whether we are currently drawing a row that is part of of the text buffer, or a row that comes after the end of the text buffer
         // to draw a row that's part of the text buffer, we write out the chars field of the erow, but first we truncate the rendered line if it would go past the end of the screen
         int filerow = y + E.rowoff;
         if (filerow >= E.numrows) {
+            editorLinePut(0, "~", 1, 0);
             if (E.numrows == 0 && y == E.screenrows / 3) {
                 char welcome[80];
                 int welcomelen = snprintf(welcome, sizeof(welcome), "Kilo editor -- version %s", KILO_VERSION);
                 // we truncate the length of the string in case the terminal is too small to fit the welcome message
                 if (welcomelen > E.screencols) welcomelen = E.screencols;
                 int padding = (E.screencols - welcomelen) / 2;
-                if (padding) {
-                    abAppend(ab, "~", 1);
-                    padding--;
-                }
-                while (padding--) abAppend(ab, " ", 1);
-                abAppend(ab, welcome, welcomelen);
-            } else {
-                abAppend(ab, "~", 1);
+                // a line with no padding has no room for the tilde
+                if (!padding) editorLineClear();
+                editorLinePut(padding, welcome, welcomelen, 0);
             }
         } else {
-            int len = E.row[filerow].rsize - E.coloff;
+            erow *row = editorRowAt(filerow);
+            // rows from a memory-mapped file get rendered and highlighted the first time they scroll into view
+            editorRowRender(row);
+            // a long row might need its window moved to where the screen is now
+            editorRowWindow(row);
+            if (row->flags & ROW_UTF8) {
+                editorDrawRowUtf8(row, filerow);
+                editorDrawLine(ab, E.screentop + y);
+                continue;
+            }
+            // render might only be a window of the row, starting at rbase
+            int off = E.coloff - row->rbase;
+            int len = row->rsize - off;
             if (len < 0) len = 0;
             if (len > E.screencols) len = E.screencols;
-            // we can longer use our previous approach of feeding the substring render that we want to print right into abAppend(), now we must do it character-by-character to handle color highlighting
-            char *c = &E.row[filerow].render[E.coloff];
+            char *c = &row->render[off];
             // first we get a pointer, hl, to the slice of the hl array that corresponds to the slice of render that we are printing
-            unsigned char *hl = &E.row[filerow].hl[E.coloff];
-            int current_color = -1; // we set this to -1 when we want the default text color, otherwise it's set to the value editorSyntaxToColor() last returned
+            unsigned char *hl = &row->hl[off];
+            int current_hl = HL_NORMAL; // the highlight of the last character we put in the line, which control characters are drawn in the color of
+            // the search match the cursor is on is drawn over the row's hl, from match_from to match_to on the screen
+            int match_from = INT_MAX, match_to = INT_MAX;
+            if (filerow == E.match_row) {
+                match_from = E.match_col - E.coloff;
+                match_to = match_from + E.match_len;
+            }
             int j;
-            // no longer up to date comment // we loop through the characters here and use isdigit() to check if a character is a number, if so then we precede it with the <esc>[32m escape sequence to make it green, then follow that with the escape sequence for the default color, <esc>[39m. the m here is the same argument we used to invert colors in the status bar
-            // for each character we check if it's HL_NORMAL (where we'd use the default color) or something else. if it's something else then we use snprintf() to write the escape sequence into a buffer which we pass to abAppend() before appending the actual character
+            // in a row that's all ASCII, each byte of render is a cell of the line
+            for (j = 0; j < len; j++) E.line_chars[j] = (unsigned char) c[j];
+            // each character's attribute is just its highlight, which editorEmitAttr() looks up the escape sequence for in HL_sgr
             for (j = 0; j < len; j++) {
                 // first we'll handle the conversion of non-printable characters to printable ones to handle edge cases, like a user opening up a file that wouldn't normally be expected in a text editor, like the executable for this program for example
                 // first we check if the current character is a control character
                 if (iscntrl(c[j])) {
-                    // if the current character is a control character, we translate it into a printable character by adding its value to '@' or '?' depending on if it's in the alphabetic range or not
-                    char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-                    // we use <esc>[7m to switch to inverted colors before printing the translated symbol
-                    abAppend(ab, "\x1b[7m", 4);
-                    abAppend(ab, &sym, 1);
-                    // we use <esc>[m to turn off inverted colors again, but this also turns off all text formatting, so we need to print the escape sequence for the corrent current color afterwards
-                    abAppend(ab, "\x1b[m", 3);
-                    if (current_color != -1) {
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
-                        abAppend(ab, buf, clen);
-                    }
-                } else if (hl[j] == HL_NORMAL) {
-                    if (current_color != -1) {
-                        // when we go from highlighted text back to HL_NORMAL we print out the normal color escape sequence and set current_color to -1
-                        abAppend(ab, "\x1b[39m", 5);
-                        current_color = -1;
-                    }
-                    abAppend(ab, &c[j], 1);
-                // if the color changes, we print out the escape sequence for that new color and set current_color to it
+                    // if the current character is a control character, we translate it into a printable character by adding its value to '@' or '?' depending on if it's in the alphabetic range or not, and draw it with inverted colors
+                    E.line_chars[j] = (c[j] <= 26) ? '@' + c[j] : '?';
+                    E.line_attrs[j] = KILO_ATTR_INVERSE | current_hl;
                 } else {
-                    int color = editorSyntaxToColor(hl[j]);
-                    if (color != current_color) {
-                        current_color = color;
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-                        abAppend(ab, buf, clen);
-                    }
-                    abAppend(ab, &c[j], 1);
+                    current_hl = (j >= match_from && j < match_to) ? HL_MATCH : hl[j];
+                    E.line_attrs[j] = current_hl;
                 }
             }
-            // after we're done loopthrough and display all the characters, we print a final <esc>[39m escape sequence to make sure the text color is reset to default
-            abAppend(ab, "\x1b[39m", 5);
         }
-
-        // this is to clear each line as it is redrawn, rather than clearing the entire screen before each refresh
-        // // the K command erease part of the current line, with a default argument of 0 erasing the part of the line to the right of the cursor, since we want that here, we leave out the 0 and just use <esc>[K
-        abAppend(ab, "\x1b[K", 3);
-        // this if statement checks to see if we're on the bottom row of the terminal window. if not, we do a new line carriage return
-        // if (y < E.screenrows - 1) {
-        abAppend(ab, "\r\n", 2);
-        // we removed this if-statement so that editorDrawRows() doesn't try to draw a line of text at the bottom of the screen, because now we want that line to be reserved for the status bar
-        // } 
+        editorDrawLine(ab, E.screentop + y);
     }
 }
 
-void editorDrawStatusBar(struct abuf *ab) {
-    abAppend(ab, "\x1b[7m", 4);
+// each window has a status bar of its own under it. focused is set for the window the cursor is in, which is the only one a search is going on in
+void editorDrawStatusBar(struct abuf *ab, int focused) {
     char status[80], rstatus[80];
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s", E.filename ? E.filename : "[No Name]", E.numrows, E.dirty ? "(modified)" : "");
+    // while a memory-mapped file is still being indexed we only know a lower bound on the number of lines, so we show a + after it
+    int len = snprintf(status, sizeof(status), "%.20s - %d%s lines %s%s", E.filename ? E.filename : "[No Name]", E.numrows, E.mapindexed < E.mapsize ? "+" : "", E.dirty ? "(modified) " : "", E.follow ? "(following)" : "");
     // the current line is stored in E.cy and we add 1 to that since E.cy is 0-indexed
-    int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d", E.syntax ? E.syntax->filetype : "no ft", E.cy + 1, E.numrows);
-    if (len > E.screencols) len = E.screencols;
-    abAppend(ab, status, len);
-    // after printing the first status string we print spaces until we get to the point where if we printed the second status string, it would end up right against the edge of the screen. That would be when E.screencols - len is equal to the length of the second status string
-    while (len < E.screencols) {
-        if (E.screencols - len == rlen) {
-            abAppend(ab, rstatus, rlen);
-            break;
-            // if we reach the point described above, we break out of the loop, as the entire status bar is now being printed
-        } else {
-            abAppend(ab, " ", 1);
-            len++;
-        }
+    // during a search we also show which match the cursor is on and how many there are, with a + after the count while the background search is still going
+    char count[32] = "";
+    if (E.nsearch && focused) {
+        struct searchLevel *l = &E.search[E.nsearch - 1];
+        if (l->bad) snprintf(count, sizeof(count), "bad regex | ");
+        else snprintf(count, sizeof(count), "%s%d/%d%s | ", l->regex ? "regex " : "", E.search_current + 1, l->hits.n, l->scanned < E.numrows ? "+" : "");
     }
-    abAppend(ab, "\x1b[m", 3);
-    abAppend(ab, "\r\n", 2);
+    int rlen = snprintf(rstatus, sizeof(rstatus), "%s%s | %d/%d", count, E.syntax ? E.syntax->filetype : "no ft", E.cy + 1, E.numrows);
+    if (len > E.screencols) len = E.screencols;
+    // the whole status bar is drawn with inverted colors, spaces and all
+    editorLineClear();
+    memset(E.line_attrs, KILO_ATTR_INVERSE, E.frame_cols);
+    editorLinePut(0, status, len, KILO_ATTR_INVERSE);
+    // the second status string goes right against the edge of the screen, if there's room for it after the first one
+    if (E.screencols - len >= rlen) editorLinePut(E.screencols - rlen, rstatus, rlen, KILO_ATTR_INVERSE);
+    editorDrawLine(ab, E.screentop + E.screenrows);
 }
 
 void editorDrawMessageBar(struct abuf *ab) {
-    // here we clear the message bar with the <esc>[K escape sequence
-    abAppend(ab, "\x1b[K", 3);
+    editorLineClear();
+    // the instrumentation line takes the place of the status message while it's turned on
+    if (E.stats_show) {
+        char line[160];
+        int len = editorStatsLine(line, sizeof(line));
+        editorLinePut(0, line, len < E.screencols ? len : E.screencols, 0);
+        editorDrawLine(ab, E.termrows - 1);
+        return;
+    }
     // then we make sure the message will fit the width of the screen
     int msglen = strlen(E.statusmsg);
     if (msglen > E.screencols) msglen = E.screencols;
     // then we display the message but only if it is less than 5 seconds old
     // // also the screen is only refreshed when we press a key, so a message will persist longer if no key is pressed
     if (msglen && time(NULL) - E.statusmsg_time < 5) {
-        abAppend(ab, E.statusmsg, msglen);
+        editorLinePut(0, E.statusmsg, msglen, 0);
     }
+    editorDrawLine(ab, E.termrows - 1);
 }
 
 void editorRefreshScreen(void) {
+    long long start = E.stats ? editorMicros() : 0;
     editorScroll();
-    // here we initialize a new abuf, ab, by assigning ABUF_INIT to it. we replace each occurrence of write(STDOUT_FILENO, ...) with abAppend(&ab, ...). we also pass ab into editorDrawRows(), so it can use abAppend() too. lastly, we write() the buffer's contents out to standard output, then ffree the memory used by the abuf
-    struct abuf ab = ABUF_INIT;
-    // this will clear the screen after each keypress. we are writing an escape sequence. 27, followed by [, then J which clears the screen with the argument 2, which clears the entire screen. 1 would clear it up to where the cursor is. 0 would clear it from the cursor up to the end of the screen, and 0 is the default argument
-    // // \x1b is the escape character (27 in decimal), [2J
-    // // // we are using VT100 escape sequences, suported very widely in modern terminal emulators. if we wanted to support the maximum number of terminals, we could use the ncurses library, which uses the terminfo database to figure out a terminal's capabilities and which escape sequences to use for that particular terminal
-    // lines under commented out code below may affect accuracy of comments above, somewhat
-    // write(STDIN_FILENO, "\x1b[2J", 4);
-    // write(STDIN_FILENO, "\x1b[H", 3);
+    // every row on the screen gets rehighlighted if it needs it before we start drawing
+    editorHighlightWindow();
+    E.redraw = 0;
+    E.lastframe = editorNow();
+    editorFrameResize();
+    // here we fill an abuf, ab, with everything we want to write out. we replace each occurrence of write(STDOUT_FILENO, ...) with abAppend(&ab, ...). we also pass ab into editorDrawRows(), so it can use abAppend() too. lastly, we queue the buffer's contents up for standard output
+    // // ab is static, so its memory is kept from one refresh to the next. once it has grown to fit a full screen, drawing doesn't allocate anything
+    // // it's also where the output queue points, so whatever of the last frame the terminal hasn't taken yet has to go out before we start on this one. the event loop doesn't draw until the queue is empty, so this only ever waits when something else draws
+    static struct abuf ab = ABUF_INIT;
+    editorOutputDrain();
+    abReset(&ab);
+    // // we are using VT100 escape sequences, suported very widely in modern terminal emulators. if we wanted to support the maximum number of terminals, we could use the ncurses library, which uses the terminfo database to figure out a terminal's capabilities and which escape sequences to use for that particular terminal
+    // we don't clear the screen before drawing it. each line is drawn over what was there before, and only where it changed since the last refresh
 
     // this will hide the cursor before the screen refreshes, in order to avoid it appearing anywhere odd while the screen refreshes
     abAppend(&ab, "\x1b[?25l", 6);
-    // this would have cleared the entire screen before each refresh
-    // abAppend(&ab, "\x1b[2J", 4);
-    abAppend(&ab, "\x1b[H", 3);
-
-    editorDrawRows(&ab);
-    editorDrawStatusBar(&ab);
+    int hidden = ab.len; // where the frame's own output starts, after the escape that hides the cursor
+
+    long long drawstart = E.stats ? editorMicros() : 0;
+    // each window is drawn with its view and its buffer made the current ones, so that drawing finds everything in E like it always does. windows on the same buffer share its rows, so a row on the screen in two windows is only rendered and highlighted once
+    int focus = E.curwin, match_row = E.match_row;
+    for (int w = 0; w < E.nwindows; w++) {
+        editorWindowSwitch(w);
+        if (w != focus) {
+            editorScroll();
+            editorHighlightWindow();
+        }
+        // the match the cursor is on is only drawn in the window the cursor is in
+        E.match_row = w == focus ? match_row : -1;
+        editorScrollFrame(&ab);
+        editorDrawRows(&ab);
+        editorDrawStatusBar(&ab, w == focus);
+        E.frame_rowoff = E.rowoff;
+        E.frame_coloff = E.coloff;
+    }
+    editorWindowSwitch(focus);
+    E.match_row = match_row;
     editorDrawMessageBar(&ab);
+    editorEmitAttr(&ab, 0);
+    E.frame_valid = 1;
+
+    // if nothing on the screen changed, we don't need to hide the cursor at all
+    int drew = ab.len > hidden;
+    if (!drew) ab.len = 0;
 
-    char buf[32];
     // here the H command specifies the exact position we want the cursor to move to
-    snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, (E.rx - E.coloff) + 1);
-    abAppend(&ab, buf, strlen(buf));
+    abAppendCursor(&ab, E.screentop + (E.cy - E.rowoff) + 1, (E.rx - E.coloff) + 1);
 
     // this should un-hide the cursor after the screen is drawn
-    abAppend(&ab, "\x1b[?25h", 6);
-
-    // reposition the cursor at the top-left after drawing tildes
-    write(STDOUT_FILENO, ab.b, ab.len);
-    abFree(&ab);
+    if (drew) abAppend(&ab, "\x1b[?25h", 6);
+
+    long long writestart = E.stats ? editorMicros() : 0;
+    editorOutput(ab.b, ab.len);
+    if (E.stats) {
+        long long end = editorMicros();
+        E.frame.draw = writestart - drawstart;
+        E.frame.write = end - writestart;
+        E.frame.total = end - start;
+        E.frame.bytes = ab.len;
+        editorStatsFrame(end);
+    }
 }
 
 // this function takes a format string and a variable number of arguments, similar to printf()
@@ -1147,22 +5143,124 @@ void editorSetStatusMessage(const char *fmt, ...) {
     E.statusmsg_time = time(NULL); // passing NULL to time() retuns the current time as the number of seconds since 1 Jan 1970
 }
 
+/*** instrumentation ***/
+
+int editorStatsCompare(const void *a, const void *b) {
+    int x = *(const int *) a, y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+// this gives us the p50 and p99 of one of the fields of the latest KILO_STATS_WINDOW frames, picked out by its offset in struct frameStats. frames without any keys are left out of the latency, since it's 0 for them. it returns how many frames it looked at
+int editorStatsPercentiles(size_t field, int *p50, int *p99) {
+    int v[KILO_STATS_WINDOW];
+    int n = 0;
+    int from = E.nframes > KILO_STATS_WINDOW ? E.nframes - KILO_STATS_WINDOW : 0;
+    for (int j = from; j < E.nframes; j++) {
+        struct frameStats *f = &E.frames[j % KILO_STATS_WINDOW];
+        if (field == offsetof(struct frameStats, latency) && f->keys == 0) continue;
+        v[n++] = *(int *) ((char *) f + field);
+    }
+    *p50 = *p99 = 0;
+    if (n == 0) return 0;
+    qsort(v, n, sizeof(int), editorStatsCompare);
+    *p50 = v[n / 2];
+    *p99 = v[(n * 99) / 100];
+    return n;
+}
+
+// this fills in the instrumentation line: the p50 and p99 of the key-to-screen latency and of the time a frame takes to draw, in milliseconds, and the bytes written and allocations made by the last frame
+int editorStatsLine(char *buf, int size) {
+    int l50, l99, t50, t99;
+    editorStatsPercentiles(offsetof(struct frameStats, latency), &l50, &l99);
+    editorStatsPercentiles(offsetof(struct frameStats, total), &t50, &t99);
+    struct frameStats *last = E.nframes ? &E.frames[(E.nframes - 1) % KILO_STATS_WINDOW] : &E.frame;
+    int len = snprintf(buf, size, "key p50 %.2fms p99 %.2fms | frame p50 %.2fms p99 %.2fms | %dB %d allocs | %d frames",
+        l50 / 1000.0, l99 / 1000.0, t50 / 1000.0, t99 / 1000.0, last->bytes, last->allocs, E.nframes);
+    return len < size ? len : size - 1;
+}
+
+// this writes frame j to E.stats_fp, as a line of CSV or as an object of the JSON array
+void editorStatsWrite(int j, struct frameStats *f) {
+    if (E.stats_json) {
+        fprintf(E.stats_fp, "%s  {\"frame\": %d, \"keys\": %d, \"latency_us\": %d, \"process_us\": %d, \"syntax_us\": %d, \"draw_us\": %d, \"write_us\": %d, \"total_us\": %d, \"bytes\": %d, \"allocs\": %d}",
+            j ? ",\n" : "", j, f->keys, f->latency, f->process, f->syntax, f->draw, f->write, f->total, f->bytes, f->allocs);
+    } else {
+        fprintf(E.stats_fp, "%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n",
+            j, f->keys, f->latency, f->process, f->syntax, f->draw, f->write, f->total, f->bytes, f->allocs);
+    }
+}
+
+// this is called at the end of every frame we measure. it puts the frame in the ring, writing over the oldest one once the ring is full, writes it out if there's a file to write it to, and starts measuring the next one
+void editorStatsFrame(long long end) {
+    E.frame.latency = E.firstkey ? end - E.firstkey : 0;
+    E.frame.allocs = alloc_count - E.lastallocs;
+    E.lastallocs = alloc_count;
+    E.frames[E.nframes % KILO_STATS_WINDOW] = E.frame;
+    if (E.stats_fp) editorStatsWrite(E.nframes, &E.frame);
+    E.nframes++;
+    memset(&E.frame, 0, sizeof(E.frame));
+    E.firstkey = 0;
+}
+
+// this finishes off the file of measurements when the editor exits. stdio holds on to the frames written to it until it has a buffer's worth, so writing them out as they're measured doesn't cost a write() each
+void editorStatsDump(void) {
+    if (E.stats_json) fprintf(E.stats_fp, "%s]\n", E.nframes ? "\n" : "");
+    fclose(E.stats_fp);
+    E.stats_fp = NULL;
+}
+
+// this turns on measuring, which stays on from then on, counting allocations along with it
+void editorStatsStart(void) {
+    if (E.stats) return;
+    E.stats = 1;
+    alloc_counting = 1;
+    E.lastallocs = alloc_count;
+}
+
+void editorStatsToggle(void) {
+    editorStatsStart();
+    E.stats_show = !E.stats_show;
+}
+
+void editorStatsInit(void) {
+    E.stats = 0;
+    E.stats_show = 0;
+    E.nframes = 0;
+    E.stats_fp = NULL;
+    E.stats_json = 0;
+    memset(&E.frame, 0, sizeof(E.frame));
+    E.firstkey = 0;
+    E.keyat = 0;
+    E.lastallocs = 0;
+    E.stats_path = getenv("KILO_STATS");
+    if (E.stats_path && E.stats_path[0]) {
+        editorStatsStart();
+        E.stats_fp = fopen(E.stats_path, "w");
+        if (E.stats_fp) {
+            size_t plen = strlen(E.stats_path);
+            E.stats_json = plen >= 5 && !strcmp(&E.stats_path[plen - 5], ".json");
+            if (E.stats_json) fprintf(E.stats_fp, "[\n");
+            else fprintf(E.stats_fp, "frame,keys,latency_us,process_us,syntax_us,draw_us,write_us,total_us,bytes,allocs\n");
+            atexit(editorStatsDump);
+        }
+    }
+}
+
 /*** input ***/
 
 // this function displays a prompt in the status bar for the user to enter a filename for a new file, and lets the user input a line of text after the prompt
 char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
     size_t bufsize = 128;
-    char *buf = malloc(bufsize);
+    char *buf = kmalloc(bufsize);
 
     size_t buflen = 0;
     // we initialize buf to the empty string
     buf[0] = '\0';
 
-    // this infinite loop repeatedly sets the status message, refreshes the screen, and waits for a keypress to handle
+    // this infinite loop repeatedly sets the status message and waits for a keypress to handle. the screen gets refreshed with the new status message while we wait
     while (1) {
         // the prompt is expected to be a formatted string contain an %s, which is where the user's input will display
         editorSetStatusMessage(prompt, buf);
-        editorRefreshScreen();
 
         int c = editorReadKey();
         // this will allow the user to delete input when typing a response to the save prompt
@@ -1187,11 +5285,22 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
             // if buflen reaches the maximum capacity we allocated (stored in bufsize) we double bufsize and sallocate that amount of memory before appending to buf
             if (buflen == bufsize - 1) {
                 bufsize *= 2;
-                buf = realloc(buf, bufsize);
+                buf = krealloc(buf, bufsize);
             }
             buf[buflen++] = c;
             // we also make sure that buf ends with a \0 character because both editorSetStatusMessage() and the caller of editorPrompt() will use it to know where the string ends
             buf[buflen] = '\0';
+        } else if (c == PASTE_KEY) {
+            // text pasted into a prompt goes in the same way typed characters would, leaving out anything that isn't printable
+            for (int j = 0; j < E.pastelen; j++) {
+                if (iscntrl(E.paste[j]) || (unsigned char) E.paste[j] >= 128) continue;
+                if (buflen == bufsize - 1) {
+                    bufsize *= 2;
+                    buf = krealloc(buf, bufsize);
+                }
+                buf[buflen++] = E.paste[j];
+            }
+            buf[buflen] = '\0';
         }
 
         if (callback) callback(buf, c);
@@ -1203,22 +5312,27 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int)) {
 
 void editorMoveCursor(int key) {
     // E.cy is allowed to be one line past the last line of the file, so we use the ternary operator in case ARROW_RIGHT to check if the cursor is on an actual line. If it is, then the row variable will point to the erow that the cursor is on, and we'll check if E.cx is to the left of the end of that line before we allow the cursor to move to the right
-    erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+    // moving down past the rows that have been indexed so far indexes some more of the file
+    editorIndexRows(E.cy + 1);
+    erow *row = (E.cy >= E.numrows) ? NULL : editorRowAt(E.cy);
 
     switch (key) {
         case ARROW_LEFT:
             // TODO: simplify these 4 if-statements to be one line each
             if (E.cx != 0) {
+                // the cursor moves by whole characters, so it skips back over the bytes that continue a UTF-8 sequence
                 E.cx--;
+                while (E.cx > 0 && UTF8_CONT(ROW_CHAR(row, E.cx))) E.cx--;
             // if cursor is at the left of the screen and not on the first line, pressing left will go to the end of the line above
             } else if (E.cy > 0) {
                 E.cy--;
-                E.cx = E.row[E.cy].size;
+                E.cx = editorRowAt(E.cy)->size;
             }
             break;
         case ARROW_RIGHT:
             if (row && E.cx < row->size) {
                 E.cx++;
+                while (E.cx < row->size && UTF8_CONT(ROW_CHAR(row, E.cx))) E.cx++;
             // if cursor is at the right of the screen and not on the last line, pressing right will go to the start of the line below
             } else if (row && E.cx == row->size) {
                 E.cy++;
@@ -1239,12 +5353,14 @@ void editorMoveCursor(int key) {
 
     // Despite the change we made above to stop the cursor from moving beyond the end of its own line, it can still move up or down from the end of a longer line to beyond the end of a shorter line, so we fix that here.
     // first we have to set row again, since E.cy could point to a different line than before. Here we consider a NULL line to be of length 0
-    row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+    row = (E.cy >= E.numrows) ? NULL : editorRowAt(E.cy);
     int rowlen = row ? row->size : 0;
     // if E.cx is to the right of the end of the line, we set it to the end of the line
     if (E.cx > rowlen) {
         E.cx = rowlen;
     }
+    // moving up or down can also leave the cursor in the middle of a character, which we move it back to the start of
+    while (row && E.cx > 0 && E.cx < rowlen && UTF8_CONT(ROW_CHAR(row, E.cx))) E.cx--;
 }
 
 // this function waits for a keypress, then handles it
@@ -1252,6 +5368,7 @@ void editorProcessKeypress(void) {
     static int quit_times = KILO_QUIT_TIMES;
     
     int c = editorReadKey();
+    editorUndoBegin();
 
     switch (c) {
         case '\r':
@@ -1261,13 +5378,17 @@ void editorProcessKeypress(void) {
         case CTRL_KEY('q'):
             // clear screen and reposition cursor on intentional exit
             // this if-statement keeps track of how many times the user must press to quit, only allowing exit when it equals 0
-            if (E.dirty && quit_times > 0) {
+            // every buffer is checked, not just the one on the screen. a save that's still being written out only clears E.dirty when it's finished, so we wait for those first
+            editorEachBuffer(editorSaveWait);
+            if (editorAnyDirty() && quit_times > 0) {
                 char *s = quit_times == 1 ? "" : "s";
                 // small change of mine to make sure "s" is not included in "times" if quit_times == 1
                 editorSetStatusMessage("Warning! File has unsaved changes. Press Crt-Q %d more time%s to quit.", quit_times, s);
                 quit_times--;
                 return;
             }
+            editorEachBuffer(editorCacheSave);
+            editorOutputDrain();
             write(STDIN_FILENO, "\x1b[2J", 4);
             write(STDIN_FILENO, "\x1b[H", 3);
             exit(0);
@@ -1283,7 +5404,7 @@ void editorProcessKeypress(void) {
 
         case END_KEY:
             if (E.cy < E.numrows) {
-                E.cx = E.row[E.cy].size;
+                E.cx = editorRowAt(E.cy)->size;
             }
             break;
 
@@ -1291,6 +5412,44 @@ void editorProcessKeypress(void) {
             editorFind();
             break;
 
+        case CTRL_KEY('z'):
+            editorUndo();
+            break;
+
+        case CTRL_KEY('y'):
+            editorRedo();
+            break;
+
+        // Ctrl-O opens a file in a buffer of its own, and Ctrl-B goes through the open buffers
+        case CTRL_KEY('o'):
+            editorOpenPrompt();
+            break;
+
+        case CTRL_KEY('b'):
+            editorNextBuffer();
+            break;
+
+        // Ctrl-W splits the window the cursor is in, Ctrl-N moves the cursor into the next window down, and Ctrl-X closes the window the cursor is in
+        case CTRL_KEY('w'):
+            editorSplitWindow();
+            break;
+
+        case CTRL_KEY('n'):
+            editorWindowSwitch((E.curwin + 1) % E.nwindows);
+            break;
+
+        case CTRL_KEY('x'):
+            editorCloseWindow();
+            break;
+
+        case CTRL_KEY('e'):
+            editorFollowToggle();
+            break;
+
+        case CTRL_KEY('g'):
+            editorGotoLine();
+            break;
+
         // backspace has no human-readable backslash-escape representation in C so we make it part of the editorKey enum and assign it its ASCII value of 127
         case BACKSPACE:
         case CTRL_KEY('h'):
@@ -1306,6 +5465,7 @@ void editorProcessKeypress(void) {
                 if (c == PAGE_UP) {
                     E.cy = E.rowoff;
                 } else if (c == PAGE_DOWN) {
+                    editorIndexRows(E.rowoff + 2 * E.screenrows);
                     E.cy = E.rowoff + E.screenrows - 1;
                     if (E.cy > E.numrows) E.cy = E.numrows;
                 }
@@ -1325,6 +5485,15 @@ void editorProcessKeypress(void) {
             editorMoveCursor(c);
             break;
 
+        case PASTE_KEY:
+            editorInsertText(E.paste, E.pastelen);
+            break;
+
+        // Ctrl-T shows or hides the instrumentation line, and starts measuring the first time it's pressed
+        case CTRL_KEY('t'):
+            editorStatsToggle();
+            break;
+
         case CTRL_KEY('l'):
         case '\x1b':
             break;
@@ -1334,10 +5503,246 @@ void editorProcessKeypress(void) {
             editorInsertChar(c);
             break;
     }
+    editorUndoEnd();
     // reset quit_times confirmation count after any other key press, for the next time the user tries to quit
     quit_times = KILO_QUIT_TIMES;
 }
 
+/*** benchmarks ***/
+
+#ifdef KILO_BENCH
+// building with -DKILO_BENCH, which is what `make bench` does, adds a --bench mode to the editor. it makes up a few files, runs the editor's own code on them without a terminal, and prints how long each step took as CSV on standard output, so that two versions of the editor can be compared
+// // the screen is drawn into a temporary file instead of to a terminal, so that we can tell how many bytes each step would have sent to one
+
+FILE *bench_out; // where the results go. the screen is drawn to standard output, so this is a copy of what standard output was before it was pointed at the screen's file
+unsigned int bench_seed = 1;
+
+// the files are made up with a random number generator of our own rather than rand(), so that every run, with any C library, makes the same ones
+unsigned int editorBenchRand(void) {
+    bench_seed = bench_seed * 1103515245 + 12345;
+    return bench_seed >> 16;
+}
+
+// a log file of KILO_BENCH_LOG_LINES lines, with no filetype
+void editorBenchLog(FILE *fp) {
+    const char *levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+    for (int j = 0; j < KILO_BENCH_LOG_LINES; j++) {
+        unsigned int r = editorBenchRand();
+        fprintf(fp, "2024-03-%02d %02d:%02d:%02d.%03u %-5s [worker-%02u] GET /api/v1/items/%u took %ums\tstatus=%d\n",
+            1 + j / 86400 % 28, j / 3600 % 24, j / 60 % 60, j % 60, r % 1000, levels[r % 6], r % 32, editorBenchRand(), r % 500, r % 7 ? 200 : 500);
+    }
+}
+
+// a C file that's all one line of KILO_BENCH_LINE_BYTES bytes, like minified code, with tabs and characters that aren't ASCII in it
+void editorBenchLine(FILE *fp) {
+    const char *tokens[] = {"int ", "x", " = ", "42;", "\"str\\\"ing\" ", "/* note */", "if (", ") {", "} ", "while ", "return ", "0x1f", "'c'", ", ", "\t", "caf\xc3\xa9 "};
+    int ntokens = sizeof(tokens) / sizeof(tokens[0]);
+    long long n = 0;
+    while (n < KILO_BENCH_LINE_BYTES) {
+        const char *t = tokens[editorBenchRand() % ntokens];
+        fputs(t, fp);
+        n += strlen(t);
+    }
+    fputc('\n', fp);
+}
+
+// a C file of KILO_BENCH_NEST_LINES lines of blocks nested up to 64 deep, each with a multi-line comment that has what looks like the start of another comment inside it. C comments don't nest, so the highlighter has to keep track of exactly where each one ends
+void editorBenchNest(FILE *fp) {
+    char tabs[64];
+    memset(tabs, '\t', sizeof(tabs));
+    for (int j = 0; j < KILO_BENCH_NEST_LINES; j++) {
+        int block = j / 4;
+        // the depth goes up to 63 and back down again
+        int depth = block % 126 < 63 ? block % 126 : 126 - block % 126;
+        switch (j % 4) {
+            case 0: fprintf(fp, "%.*s/* level %d /* an opener inside a comment doesn't open another one\n", depth, tabs, depth); break;
+            case 1: fprintf(fp, "%.*s * \"quotes\" and 'quotes' don't start strings in here either\n", depth, tabs); break;
+            case 2: fprintf(fp, "%.*s */ if (depth%d) { /* short */ int v%d = %d; // and /* this doesn't open anything\n", depth, tabs, depth, depth, j); break;
+            default: fprintf(fp, "%.*s%s\n", depth, tabs, block % 126 < 63 ? "while (1) {" : "} /* done */"); break;
+        }
+    }
+}
+
+struct benchClock {
+    long long start;
+    unsigned long allocs;
+};
+
+// every step starts with an empty screen file, so the size it's grown to at the end is how many bytes the step drew
+void editorBenchStart(struct benchClock *c) {
+    if (ftruncate(STDOUT_FILENO, 0) == -1) die("ftruncate");
+    lseek(STDOUT_FILENO, 0, SEEK_SET);
+    c->allocs = alloc_count;
+    c->start = editorMicros();
+}
+
+// this prints the results of a step that did ops of something. bytes is what it drew to the screen, unless it's given, which is how saving reports the size of the file it wrote
+void editorBenchStop(struct benchClock *c, const char *corpus, const char *name, int ops, long long bytes) {
+    long long us = editorMicros() - c->start;
+    if (bytes < 0) bytes = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+    fprintf(bench_out, "%s,%s,%d,%lld,%.2f,%lld,%lu\n", corpus, name, ops, us, (double) us / (ops ? ops : 1), bytes, alloc_count - c->allocs);
+}
+
+// this runs every benchmark on one file. the edits happen in the middle of it, where the gap of each row has to be opened up, and each one is drawn, like it would be if a user typed it
+// // edits is how many characters get typed. sideways files are scrolled to the right instead of down
+void editorBenchFile(const char *corpus, char *path, const char *query, int edits, int sideways) {
+    struct benchClock c;
+    int j;
+
+    editorBenchStart(&c);
+    editorOpen(path);
+    // the benchmarks after this one shouldn't depend on how far the background indexing has got, so we wait for it to finish
+    if (E.nindexjobs) editorIndexFinish();
+    editorBenchStop(&c, corpus, "open", 1, -1);
+
+    E.cx = E.cy = E.rowoff = E.coloff = 0;
+    E.frame_valid = 0;
+    editorBenchStart(&c);
+    editorRefreshScreen();
+    editorBenchStop(&c, corpus, "draw", 1, -1);
+
+    editorBenchStart(&c);
+    for (j = 0; j < 100; j++) {
+        if (sideways) {
+            E.cx += E.screencols;
+            if (E.cx > editorRowAt(0)->size) E.cx = editorRowAt(0)->size;
+            while (E.cx > 0 && E.cx < editorRowAt(0)->size && UTF8_CONT(ROW_CHAR(editorRowAt(0), E.cx))) E.cx--;
+        } else {
+            E.cy += E.screenrows;
+            if (E.cy > E.numrows) E.cy = E.numrows;
+        }
+        editorRefreshScreen();
+    }
+    editorBenchStop(&c, corpus, "scroll", j, -1);
+
+    E.cy = E.numrows / 2;
+    erow *row = editorRowAt(E.cy);
+    E.cx = row->size / 2;
+    while (E.cx > 0 && UTF8_CONT(ROW_CHAR(row, E.cx))) E.cx--;
+    editorRefreshScreen();
+
+    const char *text = "the quick brown fox ";
+    editorBenchStart(&c);
+    for (j = 0; j < edits; j++) {
+        editorInsertChar(text[j % 20]);
+        editorRefreshScreen();
+    }
+    editorBenchStop(&c, corpus, "type", j, -1);
+
+    editorBenchStart(&c);
+    for (j = 0; j < edits / 5; j++) {
+        editorInsertNewLine();
+        editorRefreshScreen();
+    }
+    editorBenchStop(&c, corpus, "newline", j, -1);
+
+    // this deletes everything that was typed, joining the lines that were split back together
+    editorBenchStart(&c);
+    for (j = 0; j < edits + edits / 5; j++) {
+        editorDelChar();
+        editorRefreshScreen();
+    }
+    editorBenchStop(&c, corpus, "delete", j, -1);
+
+    // every row from the middle of the file on gets highlighted again, up to a limit. they're all rendered first, so that this only times the highlighting
+    int nrows = E.numrows - E.cy < 10000 ? E.numrows - E.cy : 10000;
+    for (j = 0; j < nrows; j++) editorRowRender(editorRowAt(E.cy + j));
+    editorBenchStart(&c);
+    for (j = 0; j < nrows; j++) editorUpdateSyntax(editorRowAt(E.cy + j));
+    editorBenchStop(&c, corpus, "syntax", j, -1);
+
+    // opening a comment at the start of the file changes how every row after it is highlighted, and closing it again changes them all back
+    E.cx = E.cy = 0;
+    editorBenchStart(&c);
+    for (j = 0; j < 5; j++) {
+        editorInsertChar('/');
+        editorInsertChar('*');
+        editorRefreshScreen();
+        editorDelChar();
+        editorDelChar();
+        editorRefreshScreen();
+    }
+    editorBenchStop(&c, corpus, "comment", j * 2, -1);
+
+    // this finds the first match, and then goes on to the next one, the way the arrow keys do in the search prompt
+    char q[64];
+    snprintf(q, sizeof(q), "%s", query);
+    editorBenchStart(&c);
+    editorFindCallback(q, (unsigned char) q[strlen(q) - 1]);
+    editorRefreshScreen();
+    for (j = 1; j < 50; j++) {
+        editorFindCallback(q, ARROW_DOWN);
+        editorRefreshScreen();
+    }
+    editorFindCallback(q, '\r');
+    editorBenchStop(&c, corpus, "find", j, -1);
+
+    struct stat st;
+    editorBenchStart(&c);
+    editorSave();
+    editorSaveWait();
+    editorBenchStop(&c, corpus, "save", 1, stat(path, &st) == 0 ? st.st_size : 0);
+}
+
+struct benchCorpus {
+    const char *name;
+    const char *file; // the name of the file, which decides its filetype
+    void (*make)(FILE *fp);
+    const char *query; // what the search looks for
+    int edits;
+    int sideways;
+};
+
+// this is what --bench runs. the files go in a temporary directory, one at a time, and are removed once their benchmarks are done
+int editorBench(void) {
+    struct benchCorpus corpora[] = {
+        {"log", "bench.log", editorBenchLog, "ERROR", 1000, 0},
+        {"line", "line.c", editorBenchLine, "while", 5, 1},
+        {"nest", "nest.c", editorBenchNest, "level 63", 1000, 0},
+    };
+    char dir[] = "/tmp/kilo-bench-XXXXXX";
+    if (mkdtemp(dir) == NULL) die("mkdtemp");
+    char path[64];
+
+    // standard output gets pointed at the screen's file, which is unlinked right away so that it goes away by itself when we exit
+    bench_out = fdopen(dup(STDOUT_FILENO), "w");
+    if (bench_out == NULL) die("fdopen");
+    snprintf(path, sizeof(path), "%s/screen", dir);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1 || dup2(fd, STDOUT_FILENO) == -1) die("open");
+    close(fd);
+    unlink(path);
+
+    E.headless = 1;
+    initEditor();
+    // a session cache would let later runs skip the indexing they're meant to measure
+    E.cachedir = NULL;
+    E.termrows = KILO_BENCH_ROWS;
+    E.screencols = KILO_BENCH_COLS;
+    editorLayout();
+    // like main(), we hold E.lock the whole time. the background highlighter never gets it, so every run does the same work
+    pthread_mutex_lock(&E.lock);
+    alloc_counting = 1;
+
+    fprintf(bench_out, "corpus,bench,ops,total_us,op_us,bytes,allocs\n");
+    for (size_t j = 0; j < sizeof(corpora) / sizeof(corpora[0]); j++) {
+        struct benchCorpus *b = &corpora[j];
+        snprintf(path, sizeof(path), "%s/%s", dir, b->file);
+        FILE *fp = fopen(path, "w");
+        if (fp == NULL) die("fopen");
+        b->make(fp);
+        fclose(fp);
+        editorBenchFile(b->name, path, b->query, b->edits, b->sideways);
+        fflush(bench_out);
+        editorFreeRows();
+        unlink(path);
+    }
+    rmdir(dir);
+    fclose(bench_out);
+    return 0;
+}
+#endif
+
 /*** init ***/
 
 void initEditor(void) {
@@ -1347,28 +5752,122 @@ void initEditor(void) {
     E.rowoff = 0;
     E.coloff = 0;
     E.numrows = 0; // at first the editor will only display a single line of text, and so numrows can be either 0 or 1, we'll initialize it to 0 here
-    E.row = NULL; // we'll make this a dynamically-allocated array of erow structs, initalized to NULL
+    E.blocks = NULL; // the row store starts out with no blocks, the first one is allocated when the first row is inserted
+    E.nblocks = 0;
+    E.blockcap = 0;
+    E.blocktree = NULL;
+    E.map = NULL; // no file is mapped until editorOpen() maps one
+    E.mapfd = -1;
+    E.cachedir = getenv("KILO_CACHE");
+    if (E.cachedir && !E.cachedir[0]) E.cachedir = NULL;
+    E.savejob = NULL;
+    E.rowarena.chunks = NULL;
+    E.slabs.chunks = NULL;
+    memset(E.pools, 0, sizeof(E.pools));
+    E.inlen = 0;
+    E.inpos = 0;
+    E.paste = NULL;
+    E.pastelen = 0;
+    E.pastecap = 0;
+    E.undo = NULL;
+    E.undo_tail = E.undo_cur = E.undo_head = 0;
+    E.undo_last = ULLONG_MAX;
+    E.undo_saved = 0;
+    E.undo_step = 1;
+    E.undo_typing = 0;
+    E.undo_lasttyping = 0;
+    E.undo_replay = 0;
+    E.undo_cy = E.undo_cx = 0;
+    E.outq = NULL;
+    E.outlen = 0;
+    E.follow = 0;
+    E.followfd = -1;
+    E.followwd = -1;
+    E.followq = -1;
+    E.nfollow = 0;
+    E.followbehind = 0;
+    E.lastsave = time(NULL);
+    E.mapsize = 0;
+    E.mapindexed = 0;
+    E.indexjobs = NULL;
+    E.nindexjobs = 0;
+    pthread_mutex_init(&E.indexlock, NULL);
+    pthread_mutex_init(&E.savelock, NULL);
+    pthread_mutex_init(&E.lock, NULL);
+    pthread_cond_init(&E.hlcond, NULL);
+    E.hl_frontier = INT_MAX; // the background highlighter has nothing to do until a file is opened or edited
+    E.hl_until = 0;
+    E.redraw = 1; // nothing has been drawn yet
+    E.lastframe = 0;
+    E.winch = 0;
+    E.geomquery = 0;
+    editorInitEvents();
+    // the editor starts out with one empty buffer, shown in one window that has the whole screen. E holds the state of both, and the arrays hold the ones that aren't current
+    E.buffers = kmalloc(sizeof(struct editorBuffer));
+    editorBufferInit(&E.buffers[0]);
+    E.nbuffers = 1;
+    E.curbuf = 0;
+    E.windows = kcalloc(1, sizeof(struct editorWindow));
+    E.nwindows = 1;
+    E.curwin = 0;
+    E.screentop = 0;
+    E.termrows = 0;
+    // the background highlighter waits on E.hlcond until there's a file to highlight, and it can't get E.lock until main() first waits for a key anyway
+    pthread_create(&E.hlthread, NULL, editorHlThread, NULL);
     E.dirty = 0; // setting this to 0 because by default, the file will be considred "unchanged" until we make changes. it will just be used as a boolean value but we will also increment it with each change instead of just setting it to 1, so that we can have a sense of how many changes have been made
     E.filename = NULL; // this will stay NULL if we run the program without arguments (meaning a file isn't opened)
     E.statusmsg[0] = '\0'; // initialized to an empty string so no message will be displayed by default
     E.statusmsg_time = 0; // will contain a timestamp when we set a status message
     E.syntax = NULL; // when set to null, it means there is no filetype for the current file, and no syntax highlighting should be done
-
-    if (getWindowSize(&E.screenrows, &E.screencols) == -1) die("getWindowSize");
-    // we decrement E.screenrows so that editorDrawRows() doesn't try to draw a line of text at the bottom of the screen
-    E.screenrows -= 2; // we are doing 2 now for the message area under the status bar
+    E.highlighter = NULL;
+    E.search = NULL;
+    E.nsearch = 0;
+    E.searchcap = 0;
+    E.search_current = -1;
+    E.search_regex = 0;
+    E.match_row = -1;
+    E.frame_chars = NULL;
+    E.frame_attrs = NULL;
+    E.line_chars = NULL;
+    E.line_attrs = NULL;
+    E.frame_valid = 0;
+    E.frame_attr = 0;
+    editorInitSgr();
+    editorStatsInit();
+
+    // without a terminal, whoever set E.headless decides how big the screen is
+    if (E.headless) return;
+    // editorSetGeometry() leaves the last 2 lines of the terminal out of E.screenrows, so that editorDrawRows() doesn't try to draw a line of text where the status bar and the message area go
+    int rows, cols;
+    if (getWindowSize(&rows, &cols) == -1) {
+        // we start out with a guess rather than have the user wait for the terminal to answer before they see anything
+        rows = KILO_GUESS_ROWS;
+        cols = KILO_GUESS_COLS;
+        editorQueryGeometry();
+    }
+    editorSetGeometry(rows, cols);
 }
 
 int main(int argc, char *argv[]) {
+#ifdef KILO_BENCH
+    if (argc >= 2 && strcmp(argv[1], "--bench") == 0) return editorBench();
+#endif
     enableRawMode();
     // initEditor will initialize all the fields in the E struct
     initEditor();
+    // the main thread holds E.lock whenever it isn't waiting for a key
+    pthread_mutex_lock(&E.lock);
     // we allow the user to choose a file to open by checking if they passed a filename as a command line argument
     // if they did not, we run with no arguments and editorOpen() will not be called, so they'll start with a blank file
     if (argc >= 2) {
         // if they did pass a filename as a command line argument, we call editorOpen() and pass it that filename
         editorOpen(argv[1]);
     }
+    // any other files named on the command line each get a window of their own, under the first one
+    for (int j = 2; j < argc; j++) {
+        editorSplitWindow();
+        editorOpenBuffer(argv[j]);
+    }
 
     // commenting out a lot of code which will still be useful to look at later
     // char c;
@@ -1404,12 +5903,14 @@ int main(int argc, char *argv[]) {
     // }
 
     // initial status message shows key bindings our text editor currenly uses to quit
-    editorSetStatusMessage("HELP: Ctrl-s = save | Ctrl-f = find | Ctrl-q = quit");
+    editorSetStatusMessage("HELP: Ctrl-s = save | Ctrl-q = quit | Ctrl-f = find | Ctrl-g = go to line | Ctrl-z/y = undo/redo | Ctrl-o = open | Ctrl-b = next buffer | Ctrl-w = split | Ctrl-n = next window | Ctrl-x = close window | Ctrl-e = follow | Ctrl-t = stats");
 
     // the following code replaces the previous code with new functionality
+    // // the screen isn't drawn here. editorReadKey() draws it while it waits for the next key, at most once a frame, so when keys come in faster than that, like when the user holds a key down or a burst of input arrives over a slow connection, we handle all of them before drawing the screen again
     while (1) {
-        editorRefreshScreen();
         editorProcessKeypress();
+        // keys like Page Up and Page Down work from where the screen is scrolled to, so we still scroll after each key even though we don't draw
+        editorScroll();
     }
 
     return 0;